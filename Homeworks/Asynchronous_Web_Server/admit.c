@@ -0,0 +1,197 @@
+/*
+ * Admission control - per-client token buckets
+ *
+ * Every client address gets a token bucket that fills at AWS_ADMIT_RATE
+ * requests per second up to AWS_ADMIT_BURST; a request takes one token,
+ * and a client with none left is refused (the server answers 429). The
+ * bucket also counts the client's open connections, capped at
+ * AWS_ADMIT_CONNS_PER_CLIENT.
+ *
+ * Buckets live in one open-addressing table of AWS_ADMIT_SLOTS 16-byte
+ * slots, probed linearly from a multiplicative hash of the address.
+ * Nothing is deleted one by one: when the table is three quarters full it
+ * is rebuilt without the clients that have no connection open and a full
+ * bucket, since those are indistinguishable from new clients. If that
+ * does not make room, unknown clients are let through untracked, and the
+ * table is not rebuilt again for SWEEP_INTERVAL_MS: a full table of
+ * connected clients would otherwise be rebuilt on every new client.
+ *
+ * 2022, Operating Systems
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "aws.h"
+#include "admit.h"
+#include "stats.h"
+
+#define SLOT_MASK	(AWS_ADMIT_SLOTS - 1)
+#define SLOT_LIMIT	(AWS_ADMIT_SLOTS / 4 * 3)
+
+/* tokens are kept in thousandths of a request */
+#define TOKEN		1000
+#define BURST		((uint32_t)AWS_ADMIT_BURST * TOKEN)
+
+#define SWEEP_INTERVAL_MS	1000
+
+struct bucket {
+	uint32_t addr;		/* IPv4, network order; 0 if the slot is free */
+	uint32_t tokens;
+	uint32_t stamp;		/* ms when tokens were last topped up */
+	uint32_t conns;
+};
+
+static struct bucket table[AWS_ADMIT_SLOTS];
+static struct bucket scratch[AWS_ADMIT_SLOTS];
+static size_t used;
+static uint32_t last_sweep;	/* ms of the last rebuild */
+
+static uint32_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+	return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static size_t slot_of(uint32_t addr)
+{
+	return (addr * 2654435761u) >> 7 & SLOT_MASK;
+}
+
+static void refill(struct bucket *b, uint32_t now)
+{
+	uint64_t tokens = b->tokens + (uint64_t)(now - b->stamp) *
+		AWS_ADMIT_RATE;
+
+	b->tokens = tokens > BURST ? BURST : tokens;
+	b->stamp = now;
+}
+
+static struct bucket *probe(struct bucket *t, uint32_t addr)
+{
+	size_t i = slot_of(addr);
+
+	while (t[i].addr != 0 && t[i].addr != addr)
+		i = (i + 1) & SLOT_MASK;
+
+	return &t[i];
+}
+
+/* Rebuild the table with only the clients worth remembering. */
+
+static void sweep(void)
+{
+	uint32_t now = now_ms();
+	size_t i;
+
+	last_sweep = now;
+	memset(scratch, 0, sizeof(scratch));
+	used = 0;
+
+	for (i = 0; i < AWS_ADMIT_SLOTS; i++) {
+		struct bucket *b = &table[i];
+
+		if (b->addr == 0)
+			continue;
+		refill(b, now);
+		if (b->conns == 0 && b->tokens == BURST)
+			continue;
+		*probe(scratch, b->addr) = *b;
+		used++;
+	}
+
+	memcpy(table, scratch, sizeof(table));
+	aws_stats.admit_clients = used;
+}
+
+/* The bucket of addr, created full if new; NULL if there is no room. */
+
+static struct bucket *bucket_get(uint32_t addr)
+{
+	struct bucket *b = probe(table, addr);
+
+	if (b->addr == addr)
+		return b;
+
+	if (used >= SLOT_LIMIT) {
+		if (now_ms() - last_sweep >= SWEEP_INTERVAL_MS)
+			sweep();
+		if (used >= SLOT_LIMIT) {
+			aws_stats.admit_untracked++;
+			return NULL;
+		}
+		b = probe(table, addr);
+	}
+
+	b->addr = addr;
+	b->tokens = BURST;
+	b->stamp = now_ms();
+	b->conns = 0;
+	used++;
+	aws_stats.admit_clients = used;
+
+	return b;
+}
+
+/*
+ * A connection from addr (0 for peers without an IPv4 address) was
+ * accepted. Returns 1 to keep it, counted against the client, 0 to keep
+ * it uncounted (no bucket for it) and -1 if the client has too many open.
+ */
+
+int admit_connect(uint32_t addr)
+{
+	struct bucket *b;
+
+	if (addr == 0)
+		return 0;
+
+	b = bucket_get(addr);
+	if (b == NULL)
+		return 0;
+	if (b->conns >= AWS_ADMIT_CONNS_PER_CLIENT)
+		return -1;
+
+	b->conns++;
+
+	return 1;
+}
+
+/* A connection counted by admit_connect() is gone. */
+
+void admit_disconnect(uint32_t addr)
+{
+	struct bucket *b;
+
+	if (addr == 0)
+		return;
+
+	b = probe(table, addr);
+	if (b->addr == addr && b->conns > 0)
+		b->conns--;
+}
+
+/* Take a token for a request from addr. Returns 0 if there is none. */
+
+int admit_request(uint32_t addr)
+{
+	struct bucket *b;
+
+	if (addr == 0)
+		return 1;
+
+	b = bucket_get(addr);
+	if (b == NULL)
+		return 1;
+
+	refill(b, now_ms());
+	if (b->tokens < TOKEN)
+		return 0;
+
+	b->tokens -= TOKEN;
+
+	return 1;
+}
@@ -0,0 +1,24 @@
+/*
+ * Admission control - per-client token buckets
+ *
+ * 2022, Operating Systems
+ */
+
+#ifndef ADMIT_H_
+#define ADMIT_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+int admit_connect(uint32_t addr);
+void admit_disconnect(uint32_t addr);
+int admit_request(uint32_t addr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ADMIT_H_ */
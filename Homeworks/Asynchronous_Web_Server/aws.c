@@ -1,16 +1,24 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
 #include <assert.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <sys/sendfile.h>
+#include <sys/uio.h>
 #include <netinet/tcp.h>
 #include <libaio.h>
 #include <sys/eventfd.h>
@@ -21,511 +29,2249 @@
 #include "w_epoll.h"
 #include "aws.h"
 #include "http_parser.h"
+#include "header_index.h"
+#include "route.h"
+#include "stats.h"
+#include "file_cache.h"
+#include "pipe_pool.h"
+#include "tx_sched.h"
+#include "slab.h"
+#include "recv_buf.h"
+#include "offload.h"
+#include "file_hints.h"
+#include "neg_cache.h"
+#include "fs_watch.h"
+#include "pack.h"
+#include "dir_cache.h"
+#include "resp_header.h"
+#include "stream.h"
+#include "plugin.h"
+#include "admit.h"
+#include "workers.h"
+#include "zerocopy.h"
+#include "tx_chunk.h"
 
 #define ECHO_LISTEN_PORT		42424
 #define NUM_OPS 1
 #define MIN(a,b) (((a)<(b))?(a):(b))
+#define MAX(a,b) (((a)>(b))?(a):(b))
+#define NUM_BLOCKS(sz) (((sz) + BUFSIZ - 1) / BUFSIZ)
 
-/* HTTP PARSER */
-http_parser request_parser;
+/* server socket file descriptors, -1 for a listener turned off */
+static int listenfd = -1;
+static int unixfd = -1;
 
-/* REQUEST PATH */
-char path[BUFSIZ];
+/* the Unix listener is shared by the workers and woken exclusively */
+static int unix_exclusive;
 
-/* server socket file descriptor */
-static int listenfd;
+/* listeners out of epoll for lack of descriptors, and until when */
+static int accept_paused;
+static uint64_t accept_resume;
+
+/* CPU this worker is pinned to, -1 if the server runs as one process */
+static int worker_cpu = -1;
 
 /* epoll file descriptor */
 static int epollfd;
 
-/*
- * Callback is invoked by HTTP request parser when parsing request path.
- * Request path is stored in global request_path variable.
- */
-
-static int on_path_cb(http_parser *p, const char *buf, size_t len)
-{
-	assert(p == &request_parser);
-	memcpy(path, buf, len);
+/* eventfd signalled by the offload pool when jobs are done */
+static int offloadfd;
 
-	return 0;
-}
+/* inotify descriptor watching the docroots */
+static int watchfd;
 
-/* Use mostly null settings except for on_path callback. */
-static http_parser_settings settings = {
-	/* on_message_begin */ 0,
-	/* on_header_field */ 0,
-	/* on_header_value */ 0,
-	/* on_path */ on_path_cb,
-	/* on_url */ 0,
-	/* on_fragment */ 0,
-	/* on_query_string */ 0,
-	/* on_body */ 0,
-	/* on_headers_complete */ 0,
-	/* on_message_complete */ 0
-};
+/* eventfd signalled by the plugin pool when handlers have output */
+static int pluginfd;
 
 enum connection_state {
+	STATE_RECEIVING,		/* request headers not complete yet */
 	STATE_DATA_RECEIVED,
+	STATE_OPENING,			/* waiting for the offload pool */
 	STATE_DATA_SENT,
+	STATE_CONNECTION_CLOSING,	/* half-closed, draining the peer */
 	STATE_CONNECTION_CLOSED
 };
 
 /* structure acting as a connection handler */
 struct connection {
 	int sockfd;
-	/* buffers used for receiving messages and then echoing them back */
-	char recv_buffer[BUFSIZ];
-	size_t recv_len;
+	uint32_t peer;		/* IPv4 address for admission control, or 0 */
+	int admit_counted;	/* admit_connect() counted it against peer */
+	/* request bytes, kept only until the request is parsed */
+	struct recv_buf recv;
+	http_parser parser;
 	char send_buffer[BUFSIZ];
 	size_t send_len;
 	enum connection_state state;
 
 	int event_fd;
 	io_context_t aio_ctx;
-	struct iocb **iocb_r;
-	struct iocb **iocb_w;
-	char **data_blocks;
+	struct iocb *iocb_r;
+	struct iocb *iocb_w;
+	char *data_block;
+	size_t block_cap;	/* size of data_block */
+	struct tx_chunk chunk;	/* size of the next block, see tx_chunk.c */
+	size_t block_len;	/* bytes read into data_block */
+	size_t block_off;	/* bytes of data_block already sent */
 	struct io_event *events;
 
+	struct tx_entry tx;
+	int tx_blocked;
+
+	struct header_index headers;
+	struct header_slice request_path;
+
+	const struct route *route;
+	enum route_engine engine;
+	struct cache_entry *cache;
+	struct zc_state zc;	/* zero-copy sends of cache bodies */
+	const struct pack_entry *pack;
+	off_t pack_off;		/* archive offset of the representation sent */
+	size_t sent;		/* header bytes (cache engine: header + body) */
+	off_t file_off;		/* next file byte to read or send */
+	struct pipe_pair pipe;
+	struct stream stream;	/* generated body, buf NULL if none */
 	char path[BUFSIZ];
+	size_t path_len;
+	unsigned int neg_generation;	/* cache generations when open started */
+	unsigned int cache_generation;
+	struct offload_job open_job;
+	struct connection *open_next;	/* in the open wait list */
 	int file;
-	int file_sz;
-	short file_type;
+	off_t file_sz;
 	short header_is_written;
+
+	/* teardown: place in the drain list and when draining gives up */
+	struct connection *drain_prev;
+	struct connection *drain_next;
+	uint64_t drain_deadline;
+};
+
+/* connection handlers are recycled through a slab */
+static struct slab conn_slab;
+
+/* half-closed connections waiting for the peer to close, oldest first */
+static struct connection *drain_head;
+static struct connection *drain_tail;
+
+/* connections whose open found the offload queue full, oldest first */
+static struct connection *open_wait_head;
+static struct connection *open_wait_tail;
+
+/* caches that the file watcher keeps in sync with the docroots */
+static const struct fs_watch_ops neg_cache_watch = {
+	.invalidate = neg_cache_remove,
+	.flush = neg_cache_flush,
+};
+
+static const struct fs_watch_ops file_cache_watch = {
+	.invalidate = file_cache_invalidate,
+	.flush = file_cache_flush,
+};
+
+static const struct fs_watch_ops dir_cache_watch = {
+	.flush = dir_cache_flush,
 };
 
-struct linger linger_opt = {
-    .l_onoff = 1,  // enable SO_LINGER
-    .l_linger = 100  // linger time in seconds
+static const struct route_config aws_routes[] = {
+	{ "/" AWS_REL_STATIC_FOLDER, AWS_ABS_STATIC_FOLDER,
+		ROUTE_ENGINE_SENDFILE },
+	{ "/" AWS_REL_DYNAMIC_FOLDER, AWS_ABS_DYNAMIC_FOLDER,
+		AWS_DYNAMIC_ENGINE },
+	{ AWS_SPLICE_PATH, AWS_ABS_DYNAMIC_FOLDER, ROUTE_ENGINE_SPLICE },
+	{ AWS_STATS_PATH, NULL, ROUTE_ENGINE_STATS },
+	{ AWS_PACK_PATH, AWS_PACK_ARCHIVE, ROUTE_ENGINE_PACK },
+	{ AWS_PLUGIN_PATH, AWS_PLUGIN_OBJECT, ROUTE_ENGINE_PLUGIN },
 };
 
 /*
- * Initialize connection structure on given socket.
+ * Callback is invoked by HTTP request parser when parsing request path.
+ * Request path is kept as a slice of the connection's receive buffer.
  */
 
-static struct connection *connection_create(int sockfd)
+static int on_path_cb(http_parser *p, const char *buf, size_t len)
 {
-	struct connection *conn = malloc(sizeof(*conn));
-
-	DIE(conn == NULL, "malloc");
+	struct connection *conn = p->data;
 
-	conn->sockfd = sockfd;
-	conn->recv_len = 0;
-	conn->header_is_written = 0;
-	memset(conn->recv_buffer, 0, BUFSIZ);
-	memset(conn->send_buffer, 0, BUFSIZ);
+	assert(p == &conn->parser);
+	if (conn->request_path.len == 0)
+		conn->request_path.off = buf - conn->recv.data;
+	conn->request_path.len += len;
 
-	return conn;
+	return 0;
 }
 
-/*
- * Remove connection handler.
- */
+static int on_header_field_cb(http_parser *p, const char *buf, size_t len)
+{
+	struct connection *conn = p->data;
 
-static void connection_remove(struct connection *conn)
+	header_index_field(&conn->headers, buf, len);
+
+	return 0;
+}
+
+static int on_header_value_cb(http_parser *p, const char *buf, size_t len)
 {
-	shutdown(conn->sockfd, SHUT_RDWR);
+	struct connection *conn = p->data;
 
-	if (conn->file != -1)
-		close(conn->file);
+	header_index_value(&conn->headers, buf, len);
 
-	conn->state = STATE_CONNECTION_CLOSED;
-	free(conn);
+	return 0;
 }
 
 /*
- * Handle a new connection request on the server socket.
+ * The request is complete once its headers are: returning 1 tells the
+ * parser there is no body, and stopping at message complete leaves any
+ * bytes sent after the request unparsed.
  */
 
-static void handle_new_connection(void)
+static int on_headers_complete_cb(http_parser *p)
 {
-	static int sockfd;
-	socklen_t addrlen = sizeof(struct sockaddr_in);
-	struct sockaddr_in addr;
-	struct connection *conn;
-	int rc;
+	struct connection *conn = p->data;
 
-	/* accept new connection */
-	sockfd = accept(listenfd, (SSA *) &addr, &addrlen);
-	DIE(sockfd < 0, "accept");
+	conn->state = STATE_DATA_RECEIVED;
 
-	dlog(LOG_ERR, "Accepted connection from: %s:%d\n",
-		inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+	return 1;
+}
 
-	int yes = 1;
-	rc = setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, (char *) &yes,
-                    sizeof(int));
-	rc = setsockopt(sockfd, SOL_SOCKET, SO_LINGER, &linger_opt, sizeof(linger_opt));
-	fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) | O_NONBLOCK);
+static int on_message_complete_cb(http_parser *p)
+{
+	return 1;
+}
 
-	/* instantiate new connection handler */
-	conn = connection_create(sockfd);
+/* Use mostly null settings except for path and header callbacks. */
+static http_parser_settings settings = {
+	.on_message_begin = 0,
+	.on_header_field = on_header_field_cb,
+	.on_header_value = on_header_value_cb,
+	.on_path = on_path_cb,
+	.on_url = 0,
+	.on_fragment = 0,
+	.on_query_string = 0,
+	.on_body = 0,
+	.on_headers_complete = on_headers_complete_cb,
+	.on_message_complete = on_message_complete_cb
+};
 
-	/* add socket to epoll */
-	rc = w_epoll_add_ptr_in(epollfd, sockfd, conn);
-	DIE(rc < 0, "w_epoll_add_in");
-}
+static void io_free(struct connection *conn);
 
 /*
- * Receive message on socket.
- * Store message in recv_buffer in struct connection.
+ * Initialize connection structure on given socket.
  */
 
-static enum connection_state receive_message(struct connection *conn)
+static struct connection *connection_create(int sockfd)
 {
-	ssize_t bytes_recv;
-	int rc;
-	char abuffer[64];
+	struct connection *conn = slab_alloc(&conn_slab);
 
-	rc = get_peer_address(conn->sockfd, abuffer, 64);
-	if (rc < 0) {
-		ERR("get_peer_address");
-		goto remove_connection;
-	}
+	if (conn == NULL)
+		return NULL;
 
-	bytes_recv = recv(conn->sockfd, conn->recv_buffer, BUFSIZ, 0);
-	if (bytes_recv < 0) {		/* error in communication */
-		dlog(LOG_ERR, "Error in communication from: %s\n", abuffer);
-		goto remove_connection;
-	}
-	if (bytes_recv == 0) {		/* connection closed */
-		dlog(LOG_INFO, "Connection closed from: %s\n", abuffer);
-		goto remove_connection;
-	}
+	conn->sockfd = sockfd;
+	recv_buf_init(&conn->recv);
+	http_parser_init(&conn->parser, HTTP_REQUEST);
+	conn->parser.data = conn;
+	header_index_init(&conn->headers, NULL);
+	conn->request_path.off = 0;
+	conn->request_path.len = 0;
+	conn->header_is_written = 0;
+	conn->route = NULL;
+	conn->cache = NULL;
+	zc_init(&conn->zc);
+	conn->pack = NULL;
+	conn->sent = 0;
+	conn->file_off = 0;
+	conn->pipe.fds[0] = conn->pipe.fds[1] = -1;
+	conn->stream.buf = NULL;
+	conn->data_block = NULL;
+	tx_chunk_init(&conn->chunk);
+	tx_entry_init(&conn->tx);
+	conn->file = FILE_NOT_FOUND;
+	conn->state = STATE_RECEIVING;
+	conn->drain_prev = conn->drain_next = NULL;
+	memset(conn->send_buffer, 0, BUFSIZ);
 
-	dlog(LOG_DEBUG, "Received message from: %s\n", abuffer);
+	return conn;
+}
 
-	printf("--\n%s--\n", conn->recv_buffer);
+/* Milliseconds on the monotonic clock, for teardown deadlines. */
 
-	conn->recv_len = bytes_recv;
-	conn->state = STATE_DATA_RECEIVED;
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
 
-	return STATE_DATA_RECEIVED;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-remove_connection:
-	rc = w_epoll_remove_ptr(epollfd, conn->sockfd, conn);
-	DIE(rc < 0, "w_epoll_remove_ptr");
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-	/* remove current connection */
-	connection_remove(conn);
+/* Microseconds on the monotonic clock, for the loop's time accounting. */
 
-	return STATE_CONNECTION_CLOSED;
-}
+static uint64_t now_us(void)
+{
+	struct timespec ts;
 
-off_t get_file_sz(struct connection *conn) {
-	off_t s = lseek(conn->file, 0, SEEK_CUR);
-	int file_size = lseek(conn->file, 0, SEEK_END);
-	lseek(conn->file, s, SEEK_SET);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-	return file_size;
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
 
-void send_static_file(struct connection *conn) {
-	off_t sent_bytes = 0;
+/* Put the listeners in the epoll set. Returns 0 or -1. */
 
-	while (sent_bytes < conn->file_sz) {
-		int rc = sendfile(conn->sockfd, conn->file, NULL, conn->file_sz);
-		DIE(rc < 0, "Error sendfile.\n");
-		sent_bytes += rc;
-	}
+static int listeners_arm(void)
+{
+	if (listenfd >= 0 && w_epoll_add_fd_in(epollfd, listenfd) < 0)
+		return -1;
+
+	if (unixfd >= 0 && (unix_exclusive ?
+			w_epoll_add_fd_in_exclusive(epollfd, unixfd) :
+			w_epoll_add_fd_in(epollfd, unixfd)) < 0)
+		return -1;
 
-	conn->state = STATE_DATA_SENT;
+	return 0;
 }
 
-void io_free(struct connection *conn) {
-	int readb_sz = MIN(conn->file_sz, BUFSIZ);
+/*
+ * Out of descriptors: the listeners are level-triggered, so they would be
+ * reported again right away. Take them out of epoll and leave the
+ * connections in the backlog until a connection is removed, or
+ * AWS_ACCEPT_RETRY_MS have passed for descriptors held elsewhere.
+ */
 
-	for (int i = 0; i < conn->file_sz / readb_sz; i++) {
-		free(conn->iocb_r[i]);
-		free(conn->iocb_w[i]);
-		free(conn->data_blocks[i]);
-	}
+static void listeners_pause(int err)
+{
+	if (accept_paused)
+		return;
 
-	free(conn->iocb_r);
-	free(conn->iocb_w);
-	free(conn->events);
-	free(conn->data_blocks);
+	if (listenfd >= 0)
+		w_epoll_remove_fd(epollfd, listenfd);
+	if (unixfd >= 0)
+		w_epoll_remove_fd(epollfd, unixfd);
 
-	io_destroy(conn->aio_ctx);
+	accept_paused = 1;
+	accept_resume = now_ms() + AWS_ACCEPT_RETRY_MS;
+	aws_stats.accept_pauses++;
+	dlog(LOG_ERR, "accept: %s, not accepting for now\n", strerror(err));
 }
 
-void iocb_setup(struct connection *conn) {
-	conn->event_fd = eventfd(0, 0);
-	DIE(conn->event_fd < 0, "Invalid eventfd!\n");
+static void listeners_resume(void)
+{
+	if (!accept_paused)
+		return;
 
-	int readb_sz = MIN(conn->file_sz, BUFSIZ);
+	accept_paused = 0;
+	DIE(listeners_arm() < 0, "w_epoll_add_fd_in");
+}
 
-	conn->iocb_r = (struct iocb **)malloc(readb_sz * sizeof(struct iocb *));
-	for (int i = 0; i < conn->file_sz / readb_sz; i++) {
-		conn->iocb_r[i] = (struct iocb *)malloc(sizeof(struct iocb));
-		memset(conn->iocb_r[i], 0, sizeof(struct iocb));
-	}
+/*
+ * Resume accepting once the retry time of paused listeners has come.
+ * Returns the number of milliseconds until then, or
+ * EPOLL_TIMEOUT_INFINITE if the listeners are armed.
+ */
 
-	conn->iocb_w = (struct iocb **)malloc(readb_sz * sizeof(struct iocb *));
-	for (int i = 0; i < conn->file_sz / readb_sz; i++) {
-		conn->iocb_w[i] = (struct iocb *)malloc(sizeof(struct iocb));
-		memset(conn->iocb_w[i], 0, sizeof(struct iocb));
-	}
+static int accept_expire(void)
+{
+	uint64_t now;
 
-	conn->data_blocks = (char **)malloc(readb_sz * sizeof(char *));
-	for (int i = 0; i < conn->file_sz / readb_sz; i++)
-		conn->data_blocks[i] = malloc(BUFSIZ * sizeof(char));
+	if (!accept_paused)
+		return EPOLL_TIMEOUT_INFINITE;
 
-	conn->events = (struct io_event *)malloc(sizeof(struct io_event));
-	DIE(conn->events == NULL, "Error while allocating memory for events.\n");
+	now = now_ms();
+	if (accept_resume <= now) {
+		listeners_resume();
+		return EPOLL_TIMEOUT_INFINITE;
+	}
 
-	conn->aio_ctx = 0;
-	DIE(io_setup(NUM_OPS, &conn->aio_ctx) < 0, "Invalid io_setup.\n");
+	return (int)(accept_resume - now);
 }
 
-void async_IO_wait(struct connection *conn) {
-	int no_events_read = 0;
-	while (no_events_read < NUM_OPS) {
-		no_events_read = io_getevents(conn->aio_ctx, NUM_OPS, NUM_OPS,
-									conn->events, NULL);
-		DIE(no_events_read < 0, "Invalid io_getevents\n");
-	}
+static void file_dropped(struct offload_job *job)
+{
+	close(job->fd);
+	free(job);
 }
 
-void send_dynamic_file(struct connection *conn) {
-	iocb_setup(conn);
-
-	int readb_sz = MIN(conn->file_sz, BUFSIZ);
-
-	int sent_bytes = 0;
-	for (int i = 0; sent_bytes < conn->file_sz; i++) {
-		io_prep_pread(conn->iocb_r[i], conn->file, conn->data_blocks[i], readb_sz, sent_bytes);
-		io_set_eventfd(conn->iocb_r[i], conn->event_fd);
-	
-		DIE(io_submit(conn->aio_ctx, NUM_OPS, &conn->iocb_r[i]) < 0, "Invalid io_submit.\n");
-		async_IO_wait(conn);
-	
-		io_prep_pwrite(conn->iocb_w[i], conn->sockfd, conn->data_blocks[i], readb_sz, 0);
-		io_set_eventfd(conn->iocb_w[i], conn->event_fd);
+/*
+ * Close a file that has been sent. A large one leaves the page cache
+ * first, which may block, so the offload pool drops its pages and the
+ * descriptor is closed when it is done. If the pool is busy the hint is
+ * skipped.
+ */
 
-		DIE(io_submit(conn->aio_ctx, NUM_OPS, &conn->iocb_w[i]) < 0, "Invalid io_submit.\n");
-		async_IO_wait(conn);
+static void file_close(int fd, off_t size)
+{
+	struct offload_job *job;
 
-		sent_bytes += readb_sz;
-		memset(conn->events, 0, sizeof(struct io_event));
+	if (!file_hints_drop(size) ||
+			(job = calloc(1, sizeof(*job))) == NULL) {
+		close(fd);
+		return;
 	}
 
-	io_free(conn);
-	conn->state = STATE_DATA_SENT;
-}
+	job->op = OFFLOAD_FADVISE;
+	job->fd = fd;
+	job->advice = POSIX_FADV_DONTNEED;
+	job->done = file_dropped;
 
-void send_file_by_type(struct connection *conn) {
-	if (conn->file_type == STATIC) {		 /* it is STATIC */
-		send_static_file(conn);
-	} else if (conn->file_type == DYNAMIC) { /* it is DYNAMIC */
-		send_dynamic_file(conn);
-	}
+	if (offload_submit(job) == 0)
+		return;
+
+	if (AWS_OFFLOAD_THREADS == 0)
+		offload_run(job);
+	file_dropped(job);
 }
 
 /*
- * Send message on socket.
- * Store message in send_buffer in struct connection.
+ * Give back what the last request and response held: the receive buffer,
+ * the scheduler slot, the AIO context, the file or cache entry, the
+ * splice pipe and the stream. A cache entry the kernel may still be
+ * sending from without a copy is kept until connection_zc_reap() sees
+ * it let go, or the connection is removed.
  */
 
-static enum connection_state send_message(struct connection *conn)
+static void connection_release(struct connection *conn)
 {
-	if (conn->state == STATE_CONNECTION_CLOSED)
-		return STATE_CONNECTION_CLOSED;
+	recv_buf_release(&conn->recv);
+	tx_sched_remove(&conn->tx);
+	io_free(conn);
 
-	ssize_t bytes_sent;
-	int rc;
-	char abuffer[64];
+	if (conn->file != FILE_NOT_FOUND) {
+		file_close(conn->file, conn->file_sz);
+		conn->file = FILE_NOT_FOUND;
+	}
 
-	rc = get_peer_address(conn->sockfd, abuffer, 64);
-	if (rc < 0) {
-		ERR("get_peer_address");
-		goto remove_connection;
+	if (conn->cache != NULL && zc_pending(&conn->zc) == 0) {
+		file_cache_release(conn->cache);
+		conn->cache = NULL;
 	}
 
-	/*
-	 * Send data from send_buffer to the latter socket, to populate the answer
-	 * with the HTTP header
-	 */
-	ssize_t total_sent_bytes = 0;
-	while (!conn->header_is_written && total_sent_bytes < conn->send_len) {
-		bytes_sent = send(conn->sockfd, conn->send_buffer + total_sent_bytes,
-							conn->send_len - total_sent_bytes, 0);
-		if (bytes_sent < 0) {		/* error in communication */
-			dlog(LOG_ERR, "Error in communication to %s\n", abuffer);
-			goto remove_connection;
-		}
+	pipe_pool_put(&conn->pipe);
+	stream_close(&conn->stream);
+}
 
-		if (bytes_sent == 0) {		/* connection closed */
-			dlog(LOG_INFO, "Connection closed to %s\n", abuffer);
-			goto remove_connection;
-		}
+static void drain_unlink(struct connection *conn)
+{
+	if (conn->drain_prev != NULL)
+		conn->drain_prev->drain_next = conn->drain_next;
+	else
+		drain_head = conn->drain_next;
 
-		total_sent_bytes += bytes_sent;
-	}
-	conn->header_is_written = 1;
+	if (conn->drain_next != NULL)
+		conn->drain_next->drain_prev = conn->drain_prev;
+	else
+		drain_tail = conn->drain_prev;
 
-	dlog(LOG_DEBUG, "Sending message to %s\n", abuffer);
+	conn->drain_prev = conn->drain_next = NULL;
+	aws_stats.connections_draining--;
+}
 
-	printf("--\n%s--\n", conn->send_buffer);
+/*
+ * Remove connection handler: close the socket and return the handler to
+ * the slab. No SO_LINGER is set, so close() never blocks the loop.
+ */
 
-	/* Send the file - the effective content of the file reffered as conn->file */
-	if (conn->header_is_written && conn->file != FILE_NOT_FOUND)
-		send_file_by_type(conn);
+static void connection_remove(struct connection *conn)
+{
+	connection_release(conn);
 
-	if (conn->state == STATE_DATA_SENT)
-		goto remove_connection;
+	/* the kernel holds its own references to pages it still sends */
+	if (conn->cache != NULL) {
+		file_cache_release(conn->cache);
+		conn->cache = NULL;
+	}
 
-	/* all done - remove out notification */
-	rc = w_epoll_update_ptr_in(epollfd, conn->sockfd, conn);
-	DIE(rc < 0, "w_epoll_update_ptr_in");
+	if (conn->state == STATE_CONNECTION_CLOSING)
+		drain_unlink(conn);
 
-	conn->state = STATE_DATA_SENT;
+	/* a failure only means it was not there; close() drops it anyway */
+	w_epoll_remove_ptr(epollfd, conn->sockfd, conn);
+	close(conn->sockfd);
+	listeners_resume();
 
-	return STATE_DATA_SENT;
+	conn->state = STATE_CONNECTION_CLOSED;
+	if (conn->admit_counted)
+		admit_disconnect(conn->peer);
+	aws_stats.connections_active--;
+	slab_free(&conn_slab, conn);
+}
 
-remove_connection:
-	rc = w_epoll_remove_ptr(epollfd, conn->sockfd, conn);
-	DIE(rc < 0, "w_epoll_remove_ptr");
+/*
+ * An operation on the connection failed with err (0 if it just came up
+ * short). Count it and have the connection removed; nothing else is
+ * affected. Callers that cannot remove it on the spot, like stream
+ * callbacks, leave it in the scheduler, whose next turn removes it.
+ */
 
-	/* remove current connection */
-	connection_remove(conn);
+static void connection_fail(struct connection *conn, int err)
+{
+	stats_connection_error(err);
+	conn->state = STATE_CONNECTION_CLOSED;
+}
 
-	return STATE_CONNECTION_CLOSED;
+/*
+ * The socket's error queue has zero-copy completions. Once the kernel is
+ * done with a finished response's cache entry, give the entry back.
+ */
+
+static void connection_zc_reap(struct connection *conn)
+{
+	zc_reap(conn->sockfd, &conn->zc);
+
+	if (conn->state == STATE_CONNECTION_CLOSING && conn->cache != NULL &&
+			zc_pending(&conn->zc) == 0) {
+		file_cache_release(conn->cache);
+		conn->cache = NULL;
+	}
 }
 
-void determine_file_type(struct connection* conn) {
-	char temp[BUFSIZ];
-	char delim = '/';
+/*
+ * Start an orderly close once the response is out: send FIN with a
+ * half-close and keep reading until the peer closes too, so that its
+ * late data does not make the kernel answer with a reset that could
+ * destroy the end of the response. Draining is bounded by
+ * AWS_DRAIN_TIMEOUT_MS; the connection waits in the drain list, which is
+ * sorted by deadline since every connection gets the same timeout.
+ */
+
+static void connection_close(struct connection *conn)
+{
+	int rc;
 
-	memmove(temp, path + 1, strlen(path) - 1);
-	temp[strlen(temp)] = '\0';
+	connection_release(conn);
 
-	char *p = strtok(temp, &delim);
-	if (!p) {
-		conn->file_type = FILE_NOT_FOUND;
+	if (shutdown(conn->sockfd, SHUT_WR) < 0) {
+		stats_connection_error(errno);
+		connection_remove(conn);
 		return;
 	}
 
-	if (!strcmp(p, "static")) {
-		conn->file_type = STATIC;
-	} else if (!strcmp(p, "dynamic")) {
-		conn->file_type = DYNAMIC;
-	} else {
-		conn->file_type = FILE_NOT_FOUND;
+	rc = w_epoll_update_ptr_in(epollfd, conn->sockfd, conn);
+	if (rc < 0) {
+		stats_connection_error(errno);
+		connection_remove(conn);
+		return;
 	}
+
+	conn->state = STATE_CONNECTION_CLOSING;
+	conn->drain_deadline = now_ms() + AWS_DRAIN_TIMEOUT_MS;
+	conn->drain_next = NULL;
+	conn->drain_prev = drain_tail;
+	if (drain_tail != NULL)
+		drain_tail->drain_next = conn;
+	else
+		drain_head = conn;
+	drain_tail = conn;
+	aws_stats.connections_draining++;
 }
 
-void set_connection_path_and_file(struct connection* conn) {
-	if (!strlen(path))
-		return;
+/*
+ * Read and drop whatever a half-closed peer still sends. The connection
+ * is removed when the peer closes its end or the socket fails.
+ */
 
-	memset(conn->path, 0, BUFSIZ);
-	memmove(conn->path, AWS_DOCUMENT_ROOT, strlen(AWS_DOCUMENT_ROOT));
-	memmove(conn->path + strlen(AWS_DOCUMENT_ROOT), path + 1, strlen(path) - 1);
+static void connection_drain(struct connection *conn)
+{
+	char discard[BUFSIZ];
+	ssize_t rc;
 
-	if (strstr(path, ".") == NULL)
-		strcat(conn->path, ".");
-	strcat(conn->path, "dat");
+	rc = recv(conn->sockfd, discard, BUFSIZ, MSG_DONTWAIT);
+	if (rc < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
 
-	conn->file = open(conn->path, O_RDWR);
-	determine_file_type(conn);
+	if (rc <= 0)
+		connection_remove(conn);
 }
 
-void set_connection_send_buffer(struct connection *conn, int file_not_found) {
-	memset(conn->send_buffer, 0, BUFSIZ);
+/*
+ * Remove the connections whose drain deadline has passed. Returns the
+ * number of milliseconds until the next deadline, or
+ * EPOLL_TIMEOUT_INFINITE if nothing is draining.
+ */
 
-	if (!file_not_found) {
-		conn->send_len = strlen(HTTP_OK_MSG);
-		memmove(conn->send_buffer, HTTP_OK_MSG, conn->send_len);
-		conn->send_buffer[conn->send_len] = '\0';
-		conn->file_sz = get_file_sz(conn);
-	} else {
-		conn->send_len = strlen(HTTP_NOT_FOUND_MSG);
-		memmove(conn->send_buffer, HTTP_NOT_FOUND_MSG, conn->send_len);
-		conn->send_buffer[conn->send_len] = '\0';
-		conn->file_sz = 0;
+static int drain_expire(void)
+{
+	uint64_t now;
+
+	if (drain_head == NULL)
+		return EPOLL_TIMEOUT_INFINITE;
+
+	now = now_ms();
+	while (drain_head != NULL && drain_head->drain_deadline <= now) {
+		aws_stats.drain_timeouts++;
+		connection_remove(drain_head);
 	}
+
+	if (drain_head == NULL)
+		return EPOLL_TIMEOUT_INFINITE;
+
+	return (int)(drain_head->drain_deadline - now);
 }
 
 /*
- * Handle a client request on a client connection.
+ * Whether a new connection has to be turned away before it costs anything:
+ * too many connections open, too much memory held by them, or too many
+ * from this client. *counted tells if a kept one was counted against peer.
  */
 
-static void handle_client_request(struct connection *conn)
+static int connection_shed(uint32_t peer, int *counted)
 {
-	int rc, nparsed;
-	enum connection_state ret_state;
-	ret_state = receive_message(conn);
-	if (ret_state == STATE_CONNECTION_CLOSED)
-		return;
+	size_t bytes;
+	int rc;
 
-	// Initialize the http_parser 
-	http_parser_init(&request_parser, HTTP_REQUEST);
-	memset(path, 0, BUFSIZ);
+	*counted = 0;
 
-	nparsed = http_parser_execute(&request_parser, &settings, conn->recv_buffer, conn->recv_len);
-	dlog(LOG_INFO, "Completed request\tpath: %s\tbytes: %d\n", path, nparsed);
+	if (aws_stats.connections_active >= AWS_MAX_CONNECTIONS)
+		return 1;
 
-	set_connection_path_and_file(conn);
+	bytes = conn_slab.in_use * conn_slab.obj_size + recv_buf_bytes();
+	if (bytes >= AWS_MAX_CONN_MEMORY)
+		return 1;
 
-	if (conn->file == FILE_NOT_FOUND)
-		set_connection_send_buffer(conn, FILE_NOT_FOUND);
-	else
-		set_connection_send_buffer(conn, FILE_FOUND);
+	rc = admit_connect(peer);
+	*counted = rc > 0;
 
-	/* add socket to epoll for out events */
-	rc = w_epoll_update_ptr_inout(epollfd, conn->sockfd, conn);
-	DIE(rc < 0, "w_epoll_add_ptr_inout");
+	return rc < 0;
 }
 
-int main(void)
+/*
+ * Count a connection whose packets are received on another CPU than the
+ * one this worker runs on: steering did not work for it.
+ */
+
+static void connection_check_cpu(int sockfd)
 {
-	int rc;
+	socklen_t len = sizeof(int);
+	int cpu;
 
-	/* init multiplexing */
-	epollfd = w_epoll_create();
-	DIE(epollfd < 0, "w_epoll_create");
+	if (getsockopt(sockfd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == 0 &&
+			cpu != worker_cpu)
+		aws_stats.connections_other_cpu++;
+}
 
-	/* create server socket */
-	listenfd = tcp_create_listener(AWS_LISTEN_PORT,
-		DEFAULT_LISTEN_BACKLOG);
-	DIE(listenfd < 0, "tcp_create_listener");
-	
-	rc = w_epoll_add_fd_in(epollfd, listenfd);
-	DIE(rc < 0, "w_epoll_add_fd_in");
+/*
+ * Handle a new connection request on server socket fd (listenfd or
+ * unixfd).
+ */
 
-	dlog(LOG_INFO, "Server waiting for connections on port %d\n",
-		AWS_LISTEN_PORT);
-	
-	/* server main loop */
-	while (1) {
-		struct epoll_event rev;
-			
-		/* wait for events */
-		rc = w_epoll_wait_infinite(epollfd, &rev);
-		DIE(rc < 0, "w_epoll_wait_infinite");
-	
-		/*
-		 * switch event types; consider
-		 *   - new connection requests (on server socket)
-		 *   - socket communication (on connection sockets)
-		 */
+static void handle_new_connection(int fd)
+{
+	static int sockfd;
+	union {
+		struct sockaddr_in in;
+		struct sockaddr_un un;
+	} addr;
+	socklen_t addrlen = sizeof(addr);
+	struct connection *conn;
+	uint32_t peer;
+	int counted, rc;
 
-		if (rev.data.fd == listenfd) {
-			dlog(LOG_DEBUG, "New connection\n");
-			if (rev.events & EPOLLIN)
-				handle_new_connection();
+	/*
+	 * accept new connection; when out of descriptors leave it in the
+	 * backlog until draining connections give some back, see
+	 * listeners_pause(). Only a broken listener is fatal, anything else
+	 * concerns the one connection.
+	 */
+	sockfd = accept(fd, (SSA *) &addr, &addrlen);
+	if (sockfd < 0) {
+		DIE(errno == EBADF || errno == EINVAL || errno == ENOTSOCK ||
+				errno == EFAULT || errno == EOPNOTSUPP, "accept");
+		rc = errno;
+		if (rc == EAGAIN || rc == EINTR)
+			return;
+		stats_connection_error(rc);
+		if (rc == EMFILE || rc == ENFILE || rc == ENOBUFS || rc == ENOMEM) {
+			listeners_pause(rc);
 		} else {
-			if (rev.events & EPOLLIN) {
-				dlog(LOG_DEBUG, "New message\n");
-				handle_client_request(rev.data.ptr);
-			}
-			if (rev.events & EPOLLOUT) {
-				dlog(LOG_DEBUG, "Ready to send message\n");
-				send_message(rev.data.ptr);
-			}
+			dlog(LOG_ERR, "accept: %s\n", strerror(rc));
 		}
+		return;
+	}
+
+	if (addr.in.sin_family == AF_INET) {
+		dlog(LOG_ERR, "Accepted connection from: %s:%d\n",
+			inet_ntoa(addr.in.sin_addr), ntohs(addr.in.sin_port));
+	} else {
+		dlog(LOG_ERR, "Accepted connection on %s\n", AWS_UNIX_SOCKET);
+	}
+
+	/*
+	 * Peers on this host (a proxy, over loopback or the Unix socket) are
+	 * not rate limited, only counted against the global limits.
+	 */
+	peer = 0;
+	if (addr.in.sin_family == AF_INET &&
+			ntohl(addr.in.sin_addr.s_addr) >> 24 != IN_LOOPBACKNET)
+		peer = addr.in.sin_addr.s_addr;
+	if (connection_shed(peer, &counted)) {
+		aws_stats.connections_shed++;
+		close(sockfd);
+		return;
+	}
+
+	int yes = 1;
+	int lowat = AWS_NOTSENT_LOWAT;
+	if (fd == listenfd) {
+		rc = setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, (char *) &yes,
+				sizeof(int));
+		if (lowat > 0)
+			setsockopt(sockfd, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+					&lowat, sizeof(lowat));
+	}
+	fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) | O_NONBLOCK);
+
+	/* instantiate new connection handler */
+	conn = connection_create(sockfd);
+	if (conn == NULL) {
+		stats_connection_error(ENOMEM);
+		if (counted)
+			admit_disconnect(peer);
+		close(sockfd);
+		return;
+	}
+	conn->peer = peer;
+	conn->admit_counted = counted;
+	aws_stats.connections_accepted++;
+	if (fd == unixfd)
+		aws_stats.connections_unix++;
+	else if (worker_cpu >= 0)
+		connection_check_cpu(sockfd);
+	aws_stats.connections_active++;
+
+	/* add socket to epoll */
+	rc = w_epoll_add_ptr_in(epollfd, sockfd, conn);
+	if (rc < 0) {
+		stats_connection_error(errno);
+		connection_remove(conn);
+	}
+}
+
+/*
+ * Receive message on socket.
+ * Append it to the connection's receive buffer and feed it to the parser.
+ * Returns STATE_RECEIVING until the request headers are complete. The
+ * buffer grows up to HTTP_MAX_HEADER_SIZE; a request that does not fit or
+ * does not parse is dropped along with the connection.
+ */
+
+static enum connection_state receive_message(struct connection *conn)
+{
+	struct recv_buf *b = &conn->recv;
+	ssize_t bytes_recv;
+	size_t nparsed;
+	int rc;
+	char abuffer[64];
+
+	rc = get_peer_address(conn->sockfd, abuffer, 64);
+	if (rc < 0) {
+		stats_connection_error(errno);
+		goto remove_connection;
+	}
+
+	if (b->len == b->size) {
+		if (recv_buf_grow(b) < 0) {
+			dlog(LOG_ERR, "Request too large from: %s\n", abuffer);
+			goto abort_request;
+		}
+		header_index_rebase(&conn->headers, b->data);
+	}
+
+	bytes_recv = recv(conn->sockfd, b->data + b->len, b->size - b->len, 0);
+	if (bytes_recv < 0 && (errno == EAGAIN || errno == EINTR))
+		return STATE_RECEIVING;
+	if (bytes_recv < 0) {		/* error in communication */
+		dlog(LOG_ERR, "Error in communication from: %s\n", abuffer);
+		stats_connection_error(errno);
+		goto remove_connection;
+	}
+	if (bytes_recv == 0) {		/* connection closed */
+		dlog(LOG_INFO, "Connection closed from: %s\n", abuffer);
+		goto remove_connection;
+	}
+
+	dlog(LOG_DEBUG, "Received message from: %s\n", abuffer);
+
+	printf("--\n%.*s--\n", (int)bytes_recv, b->data + b->len);
+
+	nparsed = http_parser_execute(&conn->parser, &settings,
+			b->data + b->len, bytes_recv);
+	b->len += bytes_recv;
+
+	if (conn->state == STATE_DATA_RECEIVED)
+		return STATE_DATA_RECEIVED;
+
+	if (nparsed != (size_t)bytes_recv) {
+		dlog(LOG_ERR, "Malformed request from: %s\n", abuffer);
+		goto abort_request;
+	}
+
+	return STATE_RECEIVING;
+
+abort_request:
+	aws_stats.requests_aborted++;
+
+remove_connection:
+	/* the peer is gone, there is nothing left to drain */
+	connection_remove(conn);
+
+	return STATE_CONNECTION_CLOSED;
+}
+
+/*
+ * The engines below send at most budget bytes of the body per call and
+ * return how many went out. A call that stops because the socket is full
+ * sets tx_blocked; one that finishes the body sets STATE_DATA_SENT, and a
+ * failed one STATE_CONNECTION_CLOSED.
+ */
+
+size_t send_static_file(struct connection *conn, size_t budget) {
+	size_t sent_bytes = 0;
+
+	while (conn->file_off < conn->file_sz && sent_bytes < budget) {
+		ssize_t rc = sendfile(conn->sockfd, conn->file, &conn->file_off,
+				MIN(conn->file_sz - conn->file_off,
+					budget - sent_bytes));
+		if (rc < 0 && errno == EAGAIN) {
+			conn->tx_blocked = 1;
+			return sent_bytes;
+		}
+		if (rc <= 0) {
+			connection_fail(conn, rc < 0 ? errno : 0);
+			return sent_bytes;
+		}
+		sent_bytes += rc;
+		aws_stats.engine_bytes[ROUTE_ENGINE_SENDFILE] += rc;
+	}
+
+	if (conn->file_off >= conn->file_sz)
+		conn->state = STATE_DATA_SENT;
+
+	return sent_bytes;
+}
+
+/*
+ * Archive entries are sent like static files, from the archive's shared
+ * descriptor starting at the entry's offset.
+ */
+
+size_t send_packed_file(struct connection *conn, size_t budget) {
+	size_t sent_bytes = 0;
+	off_t pos;
+
+	while (conn->file_off < conn->file_sz && sent_bytes < budget) {
+		pos = conn->pack_off + conn->file_off;
+		ssize_t rc = sendfile(conn->sockfd, pack_fd(), &pos,
+				MIN(conn->file_sz - conn->file_off,
+					budget - sent_bytes));
+		if (rc < 0 && errno == EAGAIN) {
+			conn->tx_blocked = 1;
+			return sent_bytes;
+		}
+		if (rc <= 0) {
+			connection_fail(conn, rc < 0 ? errno : 0);
+			return sent_bytes;
+		}
+		conn->file_off += rc;
+		sent_bytes += rc;
+		aws_stats.engine_bytes[ROUTE_ENGINE_PACK] += rc;
+	}
+
+	if (conn->file_off >= conn->file_sz)
+		conn->state = STATE_DATA_SENT;
+
+	return sent_bytes;
+}
+
+/*
+ * A streamed body is sent from the stream's buffer, which the producer
+ * refills each time it has gone out. When the producer has nothing yet
+ * the connection is parked: it leaves the scheduler and only waits for
+ * the peer to go away, until connection_resume().
+ */
+
+size_t send_streamed(struct connection *conn, size_t budget) {
+	struct stream *s = &conn->stream;
+	size_t sent_bytes = 0;
+	ssize_t rc;
+	int rv;
+
+	while (sent_bytes < budget) {
+		if (s->off == s->len) {
+			rv = stream_fill(s);
+			if (rv == 0) {
+				conn->state = STATE_DATA_SENT;
+				break;
+			}
+			if (rv == -2) {		/* truncated: do not end it */
+				connection_fail(conn, 0);
+				break;
+			}
+			if (rv < 0) {
+				rc = w_epoll_update_ptr_rdhup(epollfd, conn->sockfd,
+						conn);
+				if (rc < 0) {
+					connection_fail(conn, errno);
+					break;
+				}
+				conn->tx_blocked = 1;
+				break;
+			}
+		}
+
+		rc = send(conn->sockfd, s->buf + s->off,
+				MIN(s->len - s->off, budget - sent_bytes),
+				MSG_NOSIGNAL);
+		if (rc < 0 && errno == EAGAIN) {
+			conn->tx_blocked = 1;
+			break;
+		}
+		if (rc <= 0) {
+			connection_fail(conn, rc < 0 ? errno : 0);
+			break;
+		}
+		stream_consume(s, rc);
+		sent_bytes += rc;
+		aws_stats.engine_bytes[conn->engine] += rc;
+	}
+
+	return sent_bytes;
+}
+
+/* The producer of a parked stream has more: back to sending. */
+
+static void connection_resume(struct stream *s)
+{
+	struct connection *conn = (struct connection *)
+		((char *)s - offsetof(struct connection, stream));
+	int rc;
+
+	rc = w_epoll_update_ptr_out(epollfd, conn->sockfd, conn);
+	if (rc < 0)
+		connection_fail(conn, errno);
+	tx_sched_add(&conn->tx);
+}
+
+static void io_free(struct connection *conn) {
+	if (conn->data_block == NULL)
+		return;
+
+	free(conn->iocb_r);
+	free(conn->iocb_w);
+	free(conn->events);
+	free(conn->data_block);
+	conn->data_block = NULL;
+
+	io_destroy(conn->aio_ctx);
+	close(conn->event_fd);
+}
+
+/*
+ * Set up the AIO context and buffers of the connection. Returns 0, or a
+ * negative errno with nothing left allocated.
+ */
+
+int iocb_setup(struct connection *conn) {
+	int rc;
+
+	conn->event_fd = eventfd(0, 0);
+	if (conn->event_fd < 0)
+		return -errno;
+
+	conn->iocb_r = (struct iocb *)calloc(1, sizeof(struct iocb));
+	conn->iocb_w = (struct iocb *)calloc(1, sizeof(struct iocb));
+	conn->block_cap = tx_chunk_next(conn->sockfd, &conn->chunk);
+	conn->data_block = malloc(conn->block_cap);
+	conn->block_len = 0;
+	conn->block_off = 0;
+
+	conn->events = (struct io_event *)malloc(sizeof(struct io_event));
+
+	conn->aio_ctx = 0;
+	rc = -ENOMEM;
+	if (conn->iocb_r == NULL || conn->iocb_w == NULL ||
+			conn->data_block == NULL || conn->events == NULL)
+		goto fail;
+
+	rc = io_setup(NUM_OPS, &conn->aio_ctx);
+	if (rc < 0)
+		goto fail;
+
+	return 0;
+
+fail:
+	free(conn->iocb_r);
+	free(conn->iocb_w);
+	free(conn->events);
+	free(conn->data_block);
+	conn->data_block = NULL;
+	close(conn->event_fd);
+
+	return rc;
+}
+
+/* Wait for the submitted operation. Returns 0 or a negative errno. */
+
+int async_IO_wait(struct connection *conn) {
+	int no_events_read = 0;
+	while (no_events_read < NUM_OPS) {
+		no_events_read = io_getevents(conn->aio_ctx, NUM_OPS, NUM_OPS,
+									conn->events, NULL);
+		if (no_events_read == -EINTR)
+			no_events_read = 0;
+		else if (no_events_read < 0)
+			return no_events_read;
+	}
+
+	return 0;
+}
+
+/*
+ * One block at a time is read from the file and written to the socket; a
+ * block the socket did not take whole is finished on the next call before
+ * the following one is read. Blocks are sized by tx_chunk_next(), and
+ * data_block is reallocated between blocks when that size changes.
+ */
+
+size_t send_dynamic_file(struct connection *conn, size_t budget) {
+	size_t sent_bytes = 0;
+	long res;
+	int rc;
+
+	if (conn->data_block == NULL) {
+		rc = iocb_setup(conn);
+		if (rc < 0) {
+			connection_fail(conn, -rc);
+			return 0;
+		}
+	}
+
+	while (sent_bytes < budget) {
+		if (conn->block_off == conn->block_len) {
+			if (conn->file_off >= conn->file_sz) {
+				io_free(conn);
+				conn->state = STATE_DATA_SENT;
+				break;
+			}
+
+			size_t chunk = tx_chunk_next(conn->sockfd, &conn->chunk);
+
+			if (chunk != conn->block_cap) {
+				/* keep the old block if a new one cannot be had */
+				char *block = malloc(chunk);
+
+				if (block != NULL) {
+					free(conn->data_block);
+					conn->data_block = block;
+					conn->block_cap = chunk;
+				}
+				chunk = conn->block_cap;
+			}
+
+			size_t readb_sz = MIN(conn->file_sz - conn->file_off, chunk);
+
+			io_prep_pread(conn->iocb_r, conn->file, conn->data_block, readb_sz, conn->file_off);
+			io_set_eventfd(conn->iocb_r, conn->event_fd);
+
+			rc = io_submit(conn->aio_ctx, NUM_OPS, &conn->iocb_r);
+			if (rc >= 0)
+				rc = async_IO_wait(conn);
+			if (rc < 0) {
+				connection_fail(conn, -rc);
+				break;
+			}
+
+			res = conn->events->res;
+			if (res <= 0) {
+				connection_fail(conn, -res);
+				break;
+			}
+			conn->block_len = res;
+			aws_stats.aio_blocks++;
+			conn->block_off = 0;
+			conn->file_off += res;
+		}
+
+		io_prep_pwrite(conn->iocb_w, conn->sockfd, conn->data_block + conn->block_off,
+				conn->block_len - conn->block_off, 0);
+		io_set_eventfd(conn->iocb_w, conn->event_fd);
+
+		rc = io_submit(conn->aio_ctx, NUM_OPS, &conn->iocb_w);
+		if (rc >= 0)
+			rc = async_IO_wait(conn);
+		if (rc < 0) {
+			connection_fail(conn, -rc);
+			break;
+		}
+
+		res = conn->events->res;
+		memset(conn->events, 0, sizeof(struct io_event));
+		if (res == -EAGAIN) {
+			conn->tx_blocked = 1;
+			break;
+		}
+		if (res <= 0) {
+			connection_fail(conn, -res);
+			break;
+		}
+
+		conn->block_off += res;
+		sent_bytes += res;
+		aws_stats.engine_bytes[ROUTE_ENGINE_AIO] += res;
+	}
+
+	return sent_bytes;
+}
+
+/*
+ * Send the header and the mapped body with a single sendmsg(), picking up
+ * where the previous call stopped. The header does not count against
+ * budget, and sent_bytes reports body bytes only.
+ */
+
+size_t send_cached_file(struct connection *conn, size_t budget) {
+	size_t total = conn->send_len + conn->file_sz;
+	size_t sent_bytes = 0;
+	struct msghdr msg;
+	struct iovec iov[2];
+	int iovcnt;
+	ssize_t rc;
+
+	while (conn->sent < total && sent_bytes < budget) {
+		size_t body_off = MAX(conn->sent, conn->send_len) - conn->send_len;
+		size_t body_len = MIN(conn->file_sz - body_off, budget - sent_bytes);
+
+		iovcnt = 0;
+		if (conn->sent < conn->send_len) {
+			iov[iovcnt].iov_base = conn->send_buffer + conn->sent;
+			iov[iovcnt].iov_len = conn->send_len - conn->sent;
+			iovcnt++;
+		}
+		if (body_len > 0) {
+			iov[iovcnt].iov_base = (char *)conn->cache->addr + body_off;
+			iov[iovcnt].iov_len = body_len;
+			iovcnt++;
+		}
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iovcnt;
+
+		rc = zc_sendmsg(conn->sockfd, &conn->zc, &msg, MSG_NOSIGNAL);
+		if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			conn->tx_blocked = 1;
+			return sent_bytes;
+		}
+		if (rc <= 0) {
+			connection_fail(conn, rc < 0 ? errno : 0);
+			return sent_bytes;
+		}
+
+		if (conn->sent + rc > conn->send_len) {
+			size_t body = conn->sent + rc - MAX(conn->sent, conn->send_len);
+
+			sent_bytes += body;
+			aws_stats.engine_bytes[ROUTE_ENGINE_CACHE] += body;
+		}
+		conn->sent += rc;
+	}
+
+	if (conn->sent >= total) {
+		conn->header_is_written = 1;
+		conn->state = STATE_DATA_SENT;
+	}
+
+	return sent_bytes;
+}
+
+/*
+ * Move the file to the socket through a pipe: file -> pipe -> socket, with
+ * no copy through user memory. The pipe is refilled only once it has been
+ * drained; a full socket leaves the rest for the next EPOLLOUT.
+ */
+
+size_t send_spliced_file(struct connection *conn, size_t budget) {
+	size_t sent_bytes = 0;
+	ssize_t rc;
+
+	if (conn->pipe.fds[0] < 0 && pipe_pool_get(&conn->pipe) < 0) {
+		connection_fail(conn, errno);
+		return 0;
+	}
+
+	while ((conn->file_off < conn->file_sz || conn->pipe.pending > 0) &&
+			sent_bytes < budget) {
+		if (conn->pipe.pending == 0) {
+			rc = splice(conn->file, &conn->file_off,
+					conn->pipe.fds[1], NULL,
+					MIN(conn->file_sz - conn->file_off,
+						MIN(budget - sent_bytes, AWS_PIPE_SZ)),
+					SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (rc <= 0) {	/* read error or file truncated */
+				connection_fail(conn, rc < 0 ? errno : 0);
+				return sent_bytes;
+			}
+			conn->pipe.pending = rc;
+		}
+
+		rc = splice(conn->pipe.fds[0], NULL, conn->sockfd, NULL,
+				conn->pipe.pending,
+				SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE);
+		if (rc < 0 && errno == EAGAIN) {
+			conn->tx_blocked = 1;
+			return sent_bytes;
+		}
+		if (rc <= 0) {
+			connection_fail(conn, rc < 0 ? errno : 0);
+			return sent_bytes;
+		}
+
+		conn->pipe.pending -= rc;
+		sent_bytes += rc;
+		aws_stats.engine_bytes[ROUTE_ENGINE_SPLICE] += rc;
+	}
+
+	if (conn->file_off >= conn->file_sz && conn->pipe.pending == 0) {
+		pipe_pool_put(&conn->pipe);
+		conn->state = STATE_DATA_SENT;
+	}
+
+	return sent_bytes;
+}
+
+size_t send_file_by_type(struct connection *conn, size_t budget) {
+	switch (conn->engine) {
+	case ROUTE_ENGINE_SENDFILE:
+		return send_static_file(conn, budget);
+	case ROUTE_ENGINE_AIO:
+		return send_dynamic_file(conn, budget);
+	case ROUTE_ENGINE_CACHE:
+		return send_cached_file(conn, budget);
+	case ROUTE_ENGINE_SPLICE:
+		return send_spliced_file(conn, budget);
+	case ROUTE_ENGINE_PACK:
+		return send_packed_file(conn, budget);
+	case ROUTE_ENGINE_STATS:
+	case ROUTE_ENGINE_PLUGIN:
+		return send_streamed(conn, budget);
+	default:
+		/* the whole response already went out with the header */
+		conn->state = STATE_DATA_SENT;
+		return 0;
+	}
+}
+
+/*
+ * Send up to budget bytes of the response: the rest of the header from
+ * send_buffer, then the body through the connection's engine. Called by
+ * the transmission scheduler on each turn of the connection.
+ */
+
+static enum tx_status send_message(struct connection *conn, size_t budget,
+		size_t *sent)
+{
+	ssize_t bytes_sent;
+	size_t body_budget;
+	char abuffer[64];
+
+	*sent = 0;
+	conn->tx_blocked = 0;
+
+	/* failed outside its turn, see connection_fail() */
+	if (conn->state == STATE_CONNECTION_CLOSED)
+		goto remove_connection;
+
+	/*
+	 * Send data from send_buffer to the latter socket, to populate the answer
+	 * with the HTTP header. The cache engine sends it along with the body.
+	 */
+	while (conn->cache == NULL && conn->sent < conn->send_len) {
+		bytes_sent = send(conn->sockfd, conn->send_buffer + conn->sent,
+							conn->send_len - conn->sent, MSG_NOSIGNAL);
+		if (bytes_sent < 0 && errno == EAGAIN)
+			return TX_BLOCKED;
+
+		if (bytes_sent <= 0) {		/* error in communication */
+			stats_connection_error(bytes_sent < 0 ? errno : 0);
+			if (get_peer_address(conn->sockfd, abuffer, 64) == 0)
+				dlog(LOG_ERR, "Error in communication to %s\n", abuffer);
+			goto remove_connection;
+		}
+
+		conn->sent += bytes_sent;
+		*sent += bytes_sent;
+	}
+
+	if (!conn->header_is_written && conn->cache == NULL) {
+		conn->header_is_written = 1;
+		dlog(LOG_DEBUG, "Sending message on socket %d\n", conn->sockfd);
+		printf("--\n%s--\n", conn->send_buffer);
+	}
+
+	/* Send the file - the effective content of the file reffered as conn->file */
+	body_budget = budget > *sent ? budget - *sent : 0;
+	if (conn->file != FILE_NOT_FOUND || conn->cache != NULL ||
+			conn->pack != NULL || conn->stream.buf != NULL)
+		*sent += send_file_by_type(conn, body_budget);
+	else
+		conn->state = STATE_DATA_SENT;
+
+	conn->tx.remaining -= MIN(conn->tx.remaining, *sent);
+
+	if (conn->state == STATE_DATA_SENT) {
+		connection_close(conn);
+		return TX_DONE;
+	}
+	if (conn->state == STATE_CONNECTION_CLOSED)
+		goto remove_connection;
+
+	/* more to send - blocked ones wait for EPOLLOUT, others the next round */
+	return conn->tx_blocked ? TX_BLOCKED : TX_MORE;
+
+remove_connection:
+	/* remove current connection */
+	connection_remove(conn);
+
+	return TX_DONE;
+}
+
+static enum tx_status connection_tx(struct tx_entry *e, size_t budget,
+		size_t *sent)
+{
+	struct connection *conn = (struct connection *)
+		((char *)e - offsetof(struct connection, tx));
+
+	return send_message(conn, budget, sent);
+}
+
+/*
+ * Resolve the request path through the route table to a file name. The
+ * path is scanned once: the part after the route prefix is appended to the
+ * route's docroot while looking for an extension, and ".dat" (or "dat"
+ * after a trailing '.') is added to complete the name. Returns 1 if the
+ * file still has to be opened, 0 if the response needs no open().
+ */
+
+int set_connection_path_and_file(struct connection *conn)
+{
+	const char *req = conn->recv.data + conn->request_path.off;
+	size_t len = conn->request_path.len;
+	const struct route *route;
+	size_t matched, root_len, pos, i;
+	int has_dot = 0;
+
+	conn->file = FILE_NOT_FOUND;
+	conn->route = NULL;
+	conn->cache = NULL;
+	conn->pack = NULL;
+	if (len == 0)
+		return 0;
+
+	route = route_match(req, len, &matched);
+	if (route == NULL)
+		return 0;
+
+	conn->route = route;
+	conn->engine = route->engine;
+	if (route->docroot == NULL || route->engine == ROUTE_ENGINE_PLUGIN)
+		return 0;
+
+	/* archive entries are named relative to the archive's root */
+	root_len = route->engine == ROUTE_ENGINE_PACK ? 0 : route->docroot_len;
+
+	/* docroot + rest of the path + ".dat" must fit, NUL included */
+	if (root_len + (len - matched) + sizeof(".dat") > BUFSIZ)
+		return 0;
+
+	/*
+	 * "//" and "/./" are collapsed, so that the caches are keyed by the
+	 * same name the watcher invalidates for every spelling of a path.
+	 */
+	memcpy(conn->path, route->docroot, root_len);
+	pos = root_len;
+	for (i = matched; i < len; i++) {
+		int after_slash = pos == 0 || conn->path[pos - 1] == '/';
+
+		if (after_slash && req[i] == '/')
+			continue;
+		if (after_slash && req[i] == '.' && i + 1 < len &&
+				req[i + 1] == '/') {
+			i++;
+			continue;
+		}
+		has_dot |= (req[i] == '.');
+		conn->path[pos++] = req[i];
+	}
+
+	if (!has_dot)
+		conn->path[pos++] = '.';
+	memcpy(conn->path + pos, "dat", sizeof("dat"));
+	pos += sizeof("dat") - 1;
+	conn->path_len = pos;
+
+	if (route->engine == ROUTE_ENGINE_PACK) {
+		conn->pack = pack_lookup(conn->path, pos);
+		return 0;
+	}
+
+	/*
+	 * Cache routes, and small enough files on sendfile routes, are served
+	 * from a shared mapping; a hit needs no file syscall at all.
+	 */
+	if (route->engine == ROUTE_ENGINE_CACHE ||
+			route->engine == ROUTE_ENGINE_SENDFILE) {
+		conn->cache = file_cache_lookup(conn->path, pos);
+		if (conn->cache != NULL) {
+			conn->engine = ROUTE_ENGINE_CACHE;
+			return 0;
+		}
+	}
+
+	/* recently found missing: a 404 without touching the filesystem */
+	if (neg_cache_lookup(conn->path, pos))
+		return 0;
+
+	conn->neg_generation = neg_cache_generation();
+	conn->cache_generation = file_cache_generation();
+
+	return 1;
+}
+
+/*
+ * Attach the file opened for the request by job. On cache and sendfile
+ * routes a small enough file is moved into the file cache and served from
+ * there.
+ */
+
+static void set_connection_file(struct connection *conn,
+		struct offload_job *job)
+{
+	if (job->err != 0) {
+		if (job->fd >= 0)
+			close(job->fd);
+		conn->file = FILE_NOT_FOUND;
+		if (job->err == ENOENT || job->err == ENOTDIR)
+			neg_cache_insert(conn->path, conn->path_len,
+					conn->neg_generation);
+		else if (job->err == EXDEV || job->err == ELOOP)
+			aws_stats.paths_rejected++;
+		return;
+	}
+
+	if (job->cached == 1)
+		aws_stats.page_cache_hits++;
+	else if (job->cached == 0)
+		aws_stats.page_cache_misses++;
+
+	conn->file = job->fd;
+	conn->file_sz = job->st.st_size;
+
+	if (conn->engine != ROUTE_ENGINE_CACHE &&
+			conn->engine != ROUTE_ENGINE_SENDFILE)
+		return;
+
+	conn->cache = file_cache_insert(conn->path, conn->path_len, conn->file,
+			conn->cache_generation);
+	if (conn->cache != NULL) {
+		close(conn->file);
+		conn->file = FILE_NOT_FOUND;
+		conn->engine = ROUTE_ENGINE_CACHE;
+	}
+}
+
+/*
+ * Headers are built in place in send_buffer, from pieces that are never
+ * longer than RESP_HEADER_MAX all together; end marks where one stops.
+ */
+
+static_assert(RESP_HEADER_MAX <= BUFSIZ, "send_buffer too small");
+
+static void header_done(struct connection *conn, const char *end)
+{
+	conn->send_len = end - conn->send_buffer;
+	assert(conn->send_len <= RESP_HEADER_MAX);
+}
+
+/*
+ * Fill in the header for a file (its size came with the open, or from
+ * the cache) or for a 404. The pieces are preformatted templates, see
+ * resp_header.c.
+ */
+
+void set_connection_send_buffer(struct connection *conn, int file_not_found) {
+	const char *msg;
+	char *p = conn->send_buffer;
+
+	if (file_not_found) {
+		msg = resp_not_found(&conn->send_len);
+		assert(conn->send_len <= RESP_HEADER_MAX);
+		memcpy(conn->send_buffer, msg, conn->send_len);
+		conn->file_sz = 0;
+		return;
+	}
+
+	if (conn->cache != NULL)
+		conn->file_sz = conn->cache->size;
+
+	p += resp_header_status(p, RESP_200_OK);
+	p += resp_header_type(p, RESP_TYPE_OCTET_STREAM);
+	p += resp_header_length(p, conn->file_sz);
+	p += resp_header_end(p);
+	header_done(conn, p);
+}
+
+/* A response that is only a status line, for errors without a body. */
+
+static void set_connection_status_buffer(struct connection *conn,
+		enum resp_status status)
+{
+	char *p = conn->send_buffer;
+
+	p += resp_header_status(p, status);
+	p += resp_header_length(p, 0);
+	p += resp_header_end(p);
+	header_done(conn, p);
+	conn->file_sz = 0;
+}
+
+/*
+ * The stats route has no file behind it: its body is streamed, once or,
+ * on the follow path, until the client leaves. HTTP/1.1 clients get it
+ * chunked; for HTTP/1.0 the body ends with the connection.
+ */
+
+void set_connection_stats_buffer(struct connection *conn) {
+	const char *req = conn->recv.data + conn->request_path.off;
+	size_t len = conn->request_path.len;
+	char *p = conn->send_buffer;
+	int chunked, follow, rc;
+
+	chunked = conn->parser.http_major > 1 ||
+		(conn->parser.http_major == 1 && conn->parser.http_minor >= 1);
+	follow = len == sizeof(AWS_STATS_FOLLOW_PATH) - 1 &&
+		memcmp(req, AWS_STATS_FOLLOW_PATH, len) == 0;
+
+	rc = stats_stream_open(&conn->stream, follow, chunked);
+	if (rc < 0) {
+		stats_connection_error(ENOMEM);
+		set_connection_status_buffer(conn, RESP_500_INTERNAL_ERROR);
+		return;
+	}
+	conn->stream.resume = connection_resume;
+	conn->file_sz = 0;
+
+	p += resp_header_status(p, chunked ? RESP_200_OK_HTTP11 : RESP_200_OK);
+	p += resp_header_type(p, RESP_TYPE_TEXT_PLAIN);
+	if (chunked) {
+		p += resp_header_literal(p, "Transfer-Encoding: chunked\r\n");
+		p += resp_header_literal(p, "Connection: close\r\n");
+	}
+	p += resp_header_end(p);
+	header_done(conn, p);
+}
+
+/*
+ * Plugin pool callback: the handler has its first output, or failed
+ * before writing any. The header can now be chosen and sent.
+ */
+
+static void connection_plugin_ready(struct stream *s, int status)
+{
+	struct connection *conn = (struct connection *)
+		((char *)s - offsetof(struct connection, stream));
+	char *p = conn->send_buffer;
+
+	if (status == 0) {
+		p += resp_header_status(p, s->chunked ?
+				RESP_200_OK_HTTP11 : RESP_200_OK);
+		p += resp_header_type(p, RESP_TYPE_OCTET_STREAM);
+		if (s->chunked) {
+			p += resp_header_literal(p,
+					"Transfer-Encoding: chunked\r\n");
+			p += resp_header_literal(p, "Connection: close\r\n");
+		}
+		p += resp_header_end(p);
+		header_done(conn, p);
+		conn->file_sz = 0;
+	} else {
+		/* nothing was written: an empty, unframed body */
+		s->chunked = 0;
+		set_connection_status_buffer(conn, RESP_500_INTERNAL_ERROR);
+	}
+
+	stream_wake(s);
+}
+
+/*
+ * Queue the request for the route's plugin. The connection waits parked,
+ * out of the scheduler, until connection_plugin_ready(). Returns 0, or -1
+ * with a 404 (no such plugin) or 503 (pool full) header set up instead.
+ */
+
+static int set_connection_plugin(struct connection *conn)
+{
+	struct plugin *p = plugin_find(conn->route->docroot);
+	int chunked, rc;
+
+	if (p == NULL) {
+		set_connection_send_buffer(conn, FILE_NOT_FOUND);
+		return -1;
+	}
+
+	chunked = conn->parser.http_major > 1 ||
+		(conn->parser.http_major == 1 && conn->parser.http_minor >= 1);
+
+	if (plugin_call(p, &conn->stream,
+			conn->recv.data + conn->request_path.off,
+			conn->request_path.len, conn->route->prefix_len,
+			conn->parser.http_minor, chunked,
+			connection_plugin_ready) < 0) {
+		set_connection_status_buffer(conn, RESP_503_UNAVAILABLE);
+		return -1;
+	}
+
+	conn->stream.resume = connection_resume;
+	stream_park(&conn->stream);
+	rc = w_epoll_update_ptr_rdhup(epollfd, conn->sockfd, conn);
+	if (rc < 0) {
+		/* the scheduler removes it, which cancels the call */
+		connection_fail(conn, errno);
+		tx_sched_add(&conn->tx);
+	}
+
+	return 0;
+}
+
+/*
+ * Return 1 unless the Accept-Encoding value v (len bytes) leaves gzip out
+ * or refuses it with q=0.
+ */
+
+static int accepts_gzip(const char *v, size_t len)
+{
+	size_t i = 0, name, name_len;
+	int refused;
+
+	while (i < len) {
+		while (i < len && (v[i] == ' ' || v[i] == ','))
+			i++;
+		name = i;
+		while (i < len && v[i] != ',' && v[i] != ';' && v[i] != ' ')
+			i++;
+		name_len = i - name;
+
+		/* q=0, q=0.0, ... : the coding is not acceptable */
+		refused = 0;
+		while (i < len && v[i] != ',') {
+			if (v[i] == '=' && i > 0 && (v[i - 1] | 0x20) == 'q') {
+				refused = 1;
+				for (i++; i < len && v[i] != ',' &&
+						v[i] != ';' && v[i] != ' '; i++)
+					if (v[i] != '0' && v[i] != '.')
+						refused = 0;
+				continue;
+			}
+			i++;
+		}
+
+		if ((name_len == 4 && strncasecmp(v + name, "gzip", 4) == 0) ||
+				(name_len == 6 &&
+				 strncasecmp(v + name, "x-gzip", 6) == 0))
+			return !refused;
+	}
+
+	return 0;
+}
+
+/* Does the If-None-Match value v (len bytes) list etag (or "*")? */
+
+static int etag_matches(const char *v, size_t len, const char *etag,
+		size_t etag_len)
+{
+	while (len > 0 && *v == ' ') {
+		v++;
+		len--;
+	}
+	if (len > 0 && *v == '*')
+		return 1;
+
+	return memmem(v, len, etag, etag_len) != NULL;
+}
+
+/*
+ * Archive hits carry an ETag. A client that already has the entry gets a
+ * 304, and one that accepts gzip gets the precompressed variant if the
+ * archive has one.
+ */
+
+void set_connection_pack_buffer(struct connection *conn)
+{
+	const struct pack_entry *e = conn->pack;
+	const char *value;
+	size_t value_len, etag_len;
+	char etag[RESP_ETAG_MAX];
+	char *p = conn->send_buffer;
+	int gz = 0;
+
+	value = header_index_get(&conn->headers, HEADER_ACCEPT_ENCODING,
+			&value_len);
+	if (e->gz_size > 0 && value != NULL && accepts_gzip(value, value_len))
+		gz = 1;
+
+	etag_len = fmt_etag(etag, e->etag, gz);
+
+	value = header_index_get(&conn->headers, HEADER_IF_NONE_MATCH,
+			&value_len);
+	if (value != NULL && etag_matches(value, value_len, etag, etag_len)) {
+		p += resp_header_status(p, RESP_304_NOT_MODIFIED);
+		p += resp_header_etag(p, etag, etag_len);
+		p += resp_header_end(p);
+		header_done(conn, p);
+		conn->file_sz = 0;
+		aws_stats.responses_not_modified++;
+		return;
+	}
+
+	conn->pack_off = gz ? e->gz_off : e->off;
+	conn->file_sz = gz ? e->gz_size : e->size;
+
+	p += resp_header_status(p, RESP_200_OK);
+	p += resp_header_type(p, RESP_TYPE_OCTET_STREAM);
+	p += resp_header_etag(p, etag, etag_len);
+	p += resp_header_length(p, conn->file_sz);
+	if (gz)
+		p += resp_header_literal(p, "Content-Encoding: gzip\r\n");
+	if (e->gz_size > 0)
+		p += resp_header_literal(p, "Vary: Accept-Encoding\r\n");
+	p += resp_header_end(p);
+	header_done(conn, p);
+}
+
+/*
+ * A 404 is short and prebuilt for the current second: try to send it with
+ * a single send() straight from the template and close. Returns 0 if that worked, -1 if the
+ * response has to go through the scheduler (conn->sent says how much of
+ * it went out).
+ */
+
+static int send_not_found(struct connection *conn)
+{
+	const char *msg;
+	size_t len;
+	ssize_t rc;
+
+	msg = resp_not_found(&len);
+	rc = send(conn->sockfd, msg, len, MSG_NOSIGNAL);
+	if (rc == (ssize_t)len) {
+		connection_close(conn);
+		return 0;
+	}
+
+	conn->sent = rc > 0 ? rc : 0;
+
+	return -1;
+}
+
+/*
+ * The client is over its request rate: send the prebuilt 429 with a single
+ * send() and close. Unlike a 404 it is not worth a trip through the
+ * scheduler, so if it does not fit in the socket the connection is simply
+ * dropped.
+ */
+
+static void send_too_many(struct connection *conn)
+{
+	const char *msg;
+	size_t len;
+	ssize_t rc;
+
+	msg = resp_too_many(&len);
+	rc = send(conn->sockfd, msg, len, MSG_NOSIGNAL);
+	if (rc == (ssize_t)len)
+		connection_close(conn);
+	else
+		connection_remove(conn);
+}
+
+/*
+ * Build the response for a parsed request whose file (if any) is open and
+ * queue it for the transmission scheduler. Returns STATE_DATA_RECEIVED,
+ * or STATE_CONNECTION_CLOSING if the response already went out.
+ */
+
+static enum connection_state connection_respond(struct connection *conn)
+{
+	if (conn->route != NULL)
+		aws_stats.engine_requests[conn->engine]++;
+
+	conn->sent = 0;
+	conn->file_off = 0;
+
+	if (conn->route != NULL && conn->engine == ROUTE_ENGINE_STATS) {
+		set_connection_stats_buffer(conn);
+	} else if (conn->route != NULL && conn->engine == ROUTE_ENGINE_PLUGIN) {
+		if (set_connection_plugin(conn) == 0) {
+			conn->tx.remaining = SIZE_MAX;
+			recv_buf_release(&conn->recv);
+			header_index_init(&conn->headers, NULL);
+			return STATE_DATA_RECEIVED;
+		}
+	} else if (conn->pack != NULL) {
+		set_connection_pack_buffer(conn);
+	} else if (conn->file == FILE_NOT_FOUND && conn->cache == NULL) {
+		aws_stats.responses_not_found++;
+		if (send_not_found(conn) == 0)
+			return STATE_CONNECTION_CLOSING;
+		set_connection_send_buffer(conn, FILE_NOT_FOUND);
+	} else {
+		set_connection_send_buffer(conn, FILE_FOUND);
+	}
+
+	/* the response is sent by the transmission scheduler, in turns */
+	conn->tx.remaining = conn->send_len - conn->sent + conn->file_sz;
+	if (conn->stream.buf != NULL)
+		conn->tx.remaining = SIZE_MAX;	/* unknown, never small */
+	tx_sched_add(&conn->tx);
+
+	/* the request has been acted on, its buffer can serve another one */
+	recv_buf_release(&conn->recv);
+	header_index_init(&conn->headers, NULL);
+
+	return STATE_DATA_RECEIVED;
+}
+
+/*
+ * Offload pool callback: the file of a parked connection has been opened
+ * (or not). The connection goes back into epoll and gets its response.
+ */
+
+static void connection_opened(struct offload_job *job)
+{
+	struct connection *conn = (struct connection *)
+		((char *)job - offsetof(struct connection, open_job));
+	int rc;
+
+	set_connection_file(conn, job);
+
+	conn->state = STATE_DATA_RECEIVED;
+	rc = w_epoll_add_ptr_out(epollfd, conn->sockfd, conn);
+	if (rc < 0) {
+		stats_connection_error(errno);
+		connection_remove(conn);
+		return;
+	}
+
+	connection_respond(conn);
+}
+
+/*
+ * Open the requested file in the offload pool. The connection is parked
+ * out of epoll meanwhile, so nothing can touch or free it before
+ * connection_opened() runs; it is taken out before the job is queued,
+ * since a job cannot be called back. If the queue is full, the connection
+ * waits in the open wait list until connection_open_waiting() finds room.
+ * Returns STATE_OPENING, or STATE_DATA_RECEIVED if the pool has no
+ * threads and the file was opened right here (the connection is back in
+ * epoll, for out events), or STATE_CONNECTION_CLOSED if the connection
+ * had to be removed.
+ */
+
+static enum connection_state connection_open(struct connection *conn)
+{
+	struct offload_job *job = &conn->open_job;
+	int rc;
+
+	/* the kernel only walks the part below the route's docroot */
+	job->op = OFFLOAD_OPEN;
+	job->dirfd = conn->route->dirfd;
+	job->path = conn->path + conn->route->docroot_len;
+	job->hints = 1;
+	job->done = connection_opened;
+
+	rc = w_epoll_remove_ptr(epollfd, conn->sockfd, conn);
+	if (rc < 0)
+		goto remove_connection;
+
+	if (offload_submit(job) == 0) {
+		aws_stats.offload_jobs++;
+		conn->state = STATE_OPENING;
+		return STATE_OPENING;
+	}
+
+	/* full: an open on the loop would stall it, wait for a slot */
+	if (AWS_OFFLOAD_THREADS > 0) {
+		aws_stats.offload_waits++;
+		conn->open_next = NULL;
+		if (open_wait_tail != NULL)
+			open_wait_tail->open_next = conn;
+		else
+			open_wait_head = conn;
+		open_wait_tail = conn;
+		conn->state = STATE_OPENING;
+		return STATE_OPENING;
+	}
+
+	aws_stats.offload_inline++;
+	offload_run(job);
+	set_connection_file(conn, job);
+
+	rc = w_epoll_add_ptr_out(epollfd, conn->sockfd, conn);
+	if (rc < 0)
+		goto remove_connection;
+
+	return STATE_DATA_RECEIVED;
+
+remove_connection:
+	stats_connection_error(errno);
+	connection_remove(conn);
+
+	return STATE_CONNECTION_CLOSED;
+}
+
+/* Jobs have finished, so the queue has room: submit the waiting opens. */
+
+static void connection_open_waiting(void)
+{
+	struct connection *conn;
+
+	while (open_wait_head != NULL) {
+		conn = open_wait_head;
+		if (offload_submit(&conn->open_job) < 0)
+			return;
+
+		aws_stats.offload_jobs++;
+		open_wait_head = conn->open_next;
+		if (open_wait_head == NULL)
+			open_wait_tail = NULL;
+	}
+}
+
+/*
+ * Handle a client request on a client connection.
+ */
+
+static enum connection_state handle_client_request(struct connection *conn)
+{
+	int rc;
+	enum connection_state ret_state;
+	ret_state = receive_message(conn);
+	if (ret_state != STATE_DATA_RECEIVED)
+		return ret_state;
+
+	dlog(LOG_INFO, "Completed request\tpath: %.*s\tbytes: %zu\n",
+		(int)conn->request_path.len,
+		conn->recv.data + conn->request_path.off, conn->recv.len);
+	aws_stats.requests++;
+
+	if (!admit_request(conn->peer)) {
+		aws_stats.requests_throttled++;
+		send_too_many(conn);
+		return STATE_CONNECTION_CLOSING;
+	}
+
+	/*
+	 * wait for out events only: anything the client sends from now on is
+	 * left in the socket until the connection drains
+	 */
+	if (set_connection_path_and_file(conn)) {
+		ret_state = connection_open(conn);
+		if (ret_state != STATE_DATA_RECEIVED)
+			return ret_state;
+	} else {
+		rc = w_epoll_update_ptr_out(epollfd, conn->sockfd, conn);
+		if (rc < 0) {
+			stats_connection_error(errno);
+			connection_remove(conn);
+			return STATE_CONNECTION_CLOSED;
+		}
+	}
+
+	return connection_respond(conn);
+}
+
+/*
+ * Wait up to timeout ms for events, like epoll_wait(). In busy-poll mode a
+ * wait that could sleep first polls with a zero timeout for
+ * AWS_BUSY_POLL_US, and then sleeps for what is left of the timeout. The
+ * time in here is accounted as spinning or idle, and the time since the
+ * previous call as busy.
+ */
+
+static int loop_wait(struct epoll_event *rev, int timeout)
+{
+	static uint64_t last;
+	uint64_t start = now_us();
+	int rc, spun;
+
+	if (last != 0)
+		aws_stats.loop_busy_us += start - last;
+
+	/* work is pending: only look for new events */
+	if (timeout == 0) {
+		rc = w_epoll_wait_timeout(epollfd, rev, AWS_MAX_EVENTS, 0);
+		last = now_us();
+		return rc;
+	}
+
+	if (AWS_BUSY_POLL_US > 0) {
+		do {
+			rc = w_epoll_wait_timeout(epollfd, rev, AWS_MAX_EVENTS,
+					0);
+			last = now_us();
+		} while (rc == 0 && last - start < AWS_BUSY_POLL_US);
+
+		aws_stats.loop_spin_us += last - start;
+		if (rc != 0) {
+			if (rc > 0)
+				aws_stats.loop_spin_hits++;
+			return rc;
+		}
+
+		/* the spin is part of the wait, not added to it */
+		if (timeout > 0) {
+			spun = (last - start) / 1000;
+			timeout = spun < timeout ? timeout - spun : 0;
+		}
+		start = last;
+	}
+
+	aws_stats.loop_sleeps++;
+	rc = w_epoll_wait_timeout(epollfd, rev, AWS_MAX_EVENTS, timeout);
+	last = now_us();
+	aws_stats.loop_idle_us += last - start;
+
+	return rc;
+}
+
+int main(void)
+{
+	int listeners[AWS_WORKERS_MAX];
+	int cpus[AWS_WORKERS_MAX];
+	int workers, worker = 0;
+	size_t n;
+	int rc, i;
+
+	workers = workers_cpus(cpus, AWS_WORKERS_MAX);
+	if (workers < 1) {	/* no CPU in our mask we can name */
+		cpus[0] = 0;
+		workers = 1;
+	}
+	if (AWS_WORKERS > 0 && AWS_WORKERS < workers)
+		workers = AWS_WORKERS;
+
+	/*
+	 * create server sockets; they are made before the workers are, and
+	 * stay open in the parent across worker restarts
+	 */
+	if (AWS_TCP_LISTEN) {
+		struct listen_opts opts = {
+			.backlog = AWS_LISTEN_BACKLOG,
+			.defer_accept = AWS_DEFER_ACCEPT,
+			.fastopen = AWS_FASTOPEN_QLEN,
+			.reuseport = workers > 1,
+		};
+
+		for (i = 0; i < workers; i++) {
+			opts.cpu = cpus[i];
+			listeners[i] = tcp_create_listener_opts(AWS_LISTEN_PORT,
+					&opts);
+			DIE(listeners[i] < 0, "tcp_create_listener");
+		}
+
+		if (workers > 1 &&
+				tcp_steer_by_cpu(listeners[0], cpus, workers) < 0)
+			ERR("tcp_steer_by_cpu");
+	}
+
+	if (AWS_UNIX_LISTEN) {
+		unixfd = unix_create_listener(AWS_UNIX_SOCKET,
+			AWS_LISTEN_BACKLOG);
+		DIE(unixfd < 0, "unix_create_listener");
+	}
+
+	/* from here on everything belongs to one worker, on its CPU */
+	if (workers > 1) {
+		worker = workers_spawn(workers, cpus);
+		DIE(worker < 0, "workers_spawn");
+		worker_cpu = cpus[worker];
+		stats_worker(worker, worker_cpu);
+	}
+
+	if (AWS_TCP_LISTEN) {
+		for (i = 0; i < workers; i++)
+			if (i != worker)
+				close(listeners[i]);
+		listenfd = listeners[worker];
+	}
+
+	/* build the route table once, before serving anything */
+	rc = route_table_build(aws_routes,
+		sizeof(aws_routes) / sizeof(aws_routes[0]));
+	DIE(rc < 0, "route_table_build");
+
+	slab_init(&conn_slab, sizeof(struct connection), AWS_CONN_SLAB_CHUNK);
+	resp_header_tick();
+
+	/* without an archive the pack route answers 404 */
+	if (pack_open(AWS_PACK_ARCHIVE) < 0)
+		dlog(LOG_INFO, "No archive at %s\n", AWS_PACK_ARCHIVE);
+
+	/* init multiplexing */
+	epollfd = w_epoll_create();
+	DIE(epollfd < 0, "w_epoll_create");
+
+	/* without kernel support the loop still spins in user space */
+	if (AWS_BUSY_POLL_US > 0 && w_epoll_busy_poll(epollfd,
+			AWS_BUSY_POLL_US, AWS_BUSY_POLL_BUDGET) < 0)
+		ERR("w_epoll_busy_poll");
+
+	/* the Unix socket is shared: wake one worker per connection */
+	unix_exclusive = workers > 1;
+	rc = listeners_arm();
+	DIE(rc < 0, "w_epoll_add_fd_in");
+	if (listenfd >= 0)
+		stats_listener(listenfd);
+
+	/* blocking file syscalls are done by the offload pool */
+	offloadfd = offload_init();
+	DIE(offloadfd < 0, "offload_init");
+
+	rc = w_epoll_add_fd_in(epollfd, offloadfd);
+	DIE(rc < 0, "w_epoll_add_fd_in");
+
+	/* changes under the docroots invalidate the caches built from them */
+	watchfd = fs_watch_init();
+	DIE(watchfd < 0, "fs_watch_init");
+
+	fs_watch_register(&neg_cache_watch);
+	fs_watch_register(&file_cache_watch);
+	fs_watch_register(&dir_cache_watch);
+
+	/* handler plugins run on workers of their own */
+	pluginfd = plugin_init();
+	DIE(pluginfd < 0, "plugin_init");
+
+	rc = w_epoll_add_fd_in(epollfd, pluginfd);
+	DIE(rc < 0, "w_epoll_add_fd_in");
+
+	for (n = 0; n < sizeof(aws_routes) / sizeof(aws_routes[0]); n++) {
+		if (aws_routes[n].engine == ROUTE_ENGINE_PLUGIN) {
+			if (plugin_load(aws_routes[n].docroot) < 0)
+				dlog(LOG_INFO, "No plugin at %s\n",
+					aws_routes[n].docroot);
+			continue;
+		}
+		if (aws_routes[n].docroot == NULL ||
+				aws_routes[n].engine == ROUTE_ENGINE_PACK)
+			continue;
+		if (fs_watch_add(aws_routes[n].docroot) < 0)
+			dlog(LOG_ERR, "Cannot watch all of %s, its cache "
+				"entries will only expire\n", aws_routes[n].docroot);
+	}
+
+	rc = w_epoll_add_fd_in(epollfd, watchfd);
+	DIE(rc < 0, "w_epoll_add_fd_in");
+
+	if (listenfd >= 0)
+		dlog(LOG_INFO, "Server waiting for connections on port %d\n",
+			AWS_LISTEN_PORT);
+	if (unixfd >= 0)
+		dlog(LOG_INFO, "Server waiting for connections on %s\n",
+			AWS_UNIX_SOCKET);
+	
+	/* server main loop */
+	while (1) {
+		struct epoll_event rev[AWS_MAX_EVENTS];
+		int timeout, i;
+
+		/*
+		 * don't sleep while some connection still has its turn to take,
+		 * nor past the next drain deadline, stream wakeup or accept retry
+		 */
+		timeout = drain_expire();
+		rc = stream_expire();
+		if (rc >= 0 && (timeout < 0 || rc < timeout))
+			timeout = rc;
+		rc = accept_expire();
+		if (rc >= 0 && (timeout < 0 || rc < timeout))
+			timeout = rc;
+		if (tx_sched_pending())
+			timeout = 0;
+
+		/* wait for events */
+		rc = loop_wait(rev, timeout);
+		DIE(rc < 0 && errno != EINTR, "w_epoll_wait_timeout");
+
+		/* keep the Date in the header templates current */
+		resp_header_tick();
+
+		/*
+		 * switch event types; consider
+		 *   - new connection requests (on server socket)
+		 *   - socket communication (on connection sockets)
+		 */
+
+		for (i = 0; i < rc; i++) {
+			if (rev[i].data.fd == listenfd ||
+					rev[i].data.fd == unixfd) {
+				dlog(LOG_DEBUG, "New connection\n");
+				if (rev[i].events & EPOLLIN)
+					handle_new_connection(rev[i].data.fd);
+				continue;
+			}
+
+			if (rev[i].data.fd == offloadfd) {
+				offload_complete();
+				connection_open_waiting();
+				continue;
+			}
+
+			if (rev[i].data.fd == watchfd) {
+				fs_watch_handle();
+				continue;
+			}
+
+			if (rev[i].data.fd == pluginfd) {
+				plugin_complete();
+				continue;
+			}
+
+			struct connection *conn = rev[i].data.ptr;
+
+			/* zero-copy completions also raise EPOLLERR */
+			if ((rev[i].events & EPOLLERR) &&
+					zc_pending(&conn->zc) > 0)
+				connection_zc_reap(conn);
+
+			if (conn->state == STATE_CONNECTION_CLOSING) {
+				connection_drain(conn);
+				continue;
+			}
+
+			/* failed and waiting for the scheduler, see connection_fail() */
+			if (conn->state == STATE_CONNECTION_CLOSED) {
+				connection_remove(conn);
+				continue;
+			}
+
+			/* a parked stream only hears about the peer leaving */
+			if (conn->stream.buf != NULL && conn->stream.parked) {
+				connection_remove(conn);
+				continue;
+			}
+
+			if (rev[i].events & EPOLLIN) {
+				dlog(LOG_DEBUG, "New message\n");
+				/* only a complete request has a response to send */
+				if (handle_client_request(conn) != STATE_DATA_RECEIVED)
+					continue;
+			}
+			/* errors and hangups show up when sending */
+			if (rev[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+				dlog(LOG_DEBUG, "Ready to send message\n");
+				tx_sched_add(&conn->tx);
+			}
+		}
+
+		/* give every writable connection its share of the link */
+		tx_sched_round(connection_tx);
 	}
 
 	return 0;
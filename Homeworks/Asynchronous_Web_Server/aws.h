@@ -13,10 +13,6 @@ extern "C" {
 
 #define FILE_NOT_FOUND -1
 #define FILE_FOUND 0
-#define HTTP_NOT_FOUND_MSG "HTTP/1.0 404 Not Found\r\n\r\n"
-#define HTTP_OK_MSG "HTTP/1.0 200 OK\r\n\r\n"
-#define STATIC 1
-#define DYNAMIC 0
 
 #define AWS_LISTEN_PORT		8888
 #define AWS_DOCUMENT_ROOT	"./"
@@ -24,6 +20,311 @@ extern "C" {
 #define AWS_REL_DYNAMIC_FOLDER	"dynamic/"
 #define AWS_ABS_STATIC_FOLDER	(AWS_DOCUMENT_ROOT AWS_REL_STATIC_FOLDER)
 #define AWS_ABS_DYNAMIC_FOLDER	(AWS_DOCUMENT_ROOT AWS_REL_DYNAMIC_FOLDER)
+#define AWS_STATS_PATH		"/stats"
+#define AWS_STATS_FOLLOW_PATH	(AWS_STATS_PATH "/follow")
+#define AWS_PACK_PATH		"/pack/"
+#define AWS_PLUGIN_PATH		"/app/"
+#define AWS_SPLICE_PATH		"/splice/"
+
+/*
+ * listeners: TCP on AWS_LISTEN_PORT and, for a proxy on the same host, a
+ * Unix domain socket at AWS_UNIX_SOCKET; either may be turned off
+ */
+#ifndef AWS_TCP_LISTEN
+#define AWS_TCP_LISTEN		1
+#endif
+#ifndef AWS_UNIX_LISTEN
+#define AWS_UNIX_LISTEN		1
+#endif
+#ifndef AWS_UNIX_SOCKET
+#define AWS_UNIX_SOCKET		"/tmp/aws.sock"
+#endif
+#if !AWS_TCP_LISTEN && !AWS_UNIX_LISTEN
+#error "aws needs at least one listener"
+#endif
+
+/*
+ * listener tuning: accept queue length (capped by net.core.somaxconn),
+ * seconds the kernel holds a connection until its request arrives
+ * (TCP_DEFER_ACCEPT), and pending TCP Fast Open requests allowed; 0 turns
+ * the last two off
+ */
+#ifndef AWS_LISTEN_BACKLOG
+#define AWS_LISTEN_BACKLOG	1024
+#endif
+#ifndef AWS_DEFER_ACCEPT
+#define AWS_DEFER_ACCEPT	5
+#endif
+#ifndef AWS_FASTOPEN_QLEN
+#define AWS_FASTOPEN_QLEN	256
+#endif
+
+/*
+ * event loop processes, each pinned to a CPU and fed by its own
+ * SO_REUSEPORT listener; 0 starts one per CPU the server may use
+ */
+#ifndef AWS_WORKERS
+#define AWS_WORKERS		1
+#endif
+#ifndef AWS_WORKERS_MAX
+#define AWS_WORKERS_MAX		64
+#endif
+
+/* archive built with aws_pack, served under AWS_PACK_PATH */
+#ifndef AWS_PACK_ARCHIVE
+#define AWS_PACK_ARCHIVE	(AWS_DOCUMENT_ROOT "static.pack")
+#endif
+
+/* handler plugin mounted on AWS_PLUGIN_PATH (make plugins builds it) */
+#ifndef AWS_PLUGIN_OBJECT
+#define AWS_PLUGIN_OBJECT	(AWS_DOCUMENT_ROOT "hello.so")
+#endif
+
+/*
+ * engine for the dynamic folder: ROUTE_ENGINE_AIO or ROUTE_ENGINE_SPLICE;
+ * the folder is also served with splice() under AWS_SPLICE_PATH, so the
+ * two can be compared side by side
+ */
+#ifndef AWS_DYNAMIC_ENGINE
+#define AWS_DYNAMIC_ENGINE	ROUTE_ENGINE_AIO
+#endif
+
+/*
+ * connection teardown: after the response the socket is half-closed and
+ * what the peer still sends is read and dropped for at most this long
+ */
+#ifndef AWS_DRAIN_TIMEOUT_MS
+#define AWS_DRAIN_TIMEOUT_MS	2000
+#endif
+
+/*
+ * listeners taken out of epoll when accept() runs out of descriptors come
+ * back when a connection closes, or after this long
+ */
+#ifndef AWS_ACCEPT_RETRY_MS
+#define AWS_ACCEPT_RETRY_MS	1000
+#endif
+
+/*
+ * admission control: accepts are shed past AWS_MAX_CONNECTIONS open
+ * connections or AWS_MAX_CONN_MEMORY bytes of connection handlers and
+ * receive buffers; each client address may keep AWS_ADMIT_CONNS_PER_CLIENT
+ * connections open and make AWS_ADMIT_RATE requests per second, with
+ * bursts of up to AWS_ADMIT_BURST, before it gets 429s
+ */
+#ifndef AWS_MAX_CONNECTIONS
+#define AWS_MAX_CONNECTIONS	10000
+#endif
+#ifndef AWS_MAX_CONN_MEMORY
+#define AWS_MAX_CONN_MEMORY	(256UL << 20)
+#endif
+#ifndef AWS_ADMIT_CONNS_PER_CLIENT
+#define AWS_ADMIT_CONNS_PER_CLIENT	256
+#endif
+#ifndef AWS_ADMIT_RATE
+#define AWS_ADMIT_RATE		200
+#endif
+#ifndef AWS_ADMIT_BURST
+#define AWS_ADMIT_BURST		400
+#endif
+#ifndef AWS_ADMIT_SLOTS		/* client table size, a power of two */
+#define AWS_ADMIT_SLOTS		4096
+#endif
+
+/*
+ * streamed responses: framed bytes buffered per stream, and how often the
+ * stats route sends a new snapshot when followed (/stats/follow)
+ */
+#ifndef AWS_STREAM_BUF
+#define AWS_STREAM_BUF		16384
+#endif
+#ifndef AWS_STATS_FOLLOW_MS
+#define AWS_STATS_FOLLOW_MS	1000
+#endif
+
+/* connections allocated at once when the connection slab runs dry */
+#ifndef AWS_CONN_SLAB_CHUNK
+#define AWS_CONN_SLAB_CHUNK	16
+#endif
+
+/*
+ * request receive buffers: the smallest size, doubled as needed up to
+ * HTTP_MAX_HEADER_SIZE, and about how many bytes each pool grabs at once
+ */
+#ifndef AWS_RECV_BUF_MIN
+#define AWS_RECV_BUF_MIN	2048
+#endif
+#ifndef AWS_RECV_BUF_CHUNK
+#define AWS_RECV_BUF_CHUNK	(32 * 1024)
+#endif
+
+/*
+ * offload pool for open() and stat(): worker threads (0 runs the calls on
+ * the event loop) and job queue length, a power of two, at least 2
+ */
+#ifndef AWS_OFFLOAD_THREADS
+#define AWS_OFFLOAD_THREADS	4
+#endif
+#ifndef AWS_OFFLOAD_QUEUE
+#define AWS_OFFLOAD_QUEUE	256
+#endif
+
+/*
+ * plugin handlers: plugins loaded at most, worker threads (0 answers every
+ * plugin request with 503), calls queued at most (a power of two, at
+ * least 2) and body chunks a call may have in flight before its handler
+ * waits
+ */
+#ifndef AWS_PLUGIN_MAX
+#define AWS_PLUGIN_MAX		8
+#endif
+#ifndef AWS_PLUGIN_THREADS
+#define AWS_PLUGIN_THREADS	4
+#endif
+#ifndef AWS_PLUGIN_QUEUE
+#define AWS_PLUGIN_QUEUE	64
+#endif
+#ifndef AWS_PLUGIN_WINDOW
+#define AWS_PLUGIN_WINDOW	8
+#endif
+
+/*
+ * page cache hints for served files (0 disables each): sequential access,
+ * bytes read ahead on open, size from which a file is dropped from the
+ * page cache once sent, and probing whether files start out cached
+ */
+#ifndef AWS_FADV_SEQUENTIAL
+#define AWS_FADV_SEQUENTIAL	1
+#endif
+#ifndef AWS_READAHEAD_WINDOW
+#define AWS_READAHEAD_WINDOW	(512 * 1024)
+#endif
+#ifndef AWS_FADV_DONTNEED_MIN
+#define AWS_FADV_DONTNEED_MIN	(64UL << 20)
+#endif
+#ifndef AWS_PAGE_CACHE_PROBE
+#define AWS_PAGE_CACHE_PROBE	1
+#endif
+
+/*
+ * negative cache for missing paths: slots, seconds an entry is trusted
+ * and longest path kept
+ */
+#ifndef AWS_NEG_CACHE_SIZE
+#define AWS_NEG_CACHE_SIZE	1024
+#endif
+#ifndef AWS_NEG_CACHE_TTL
+#define AWS_NEG_CACHE_TTL	2
+#endif
+#ifndef AWS_NEG_CACHE_PATH_MAX
+#define AWS_NEG_CACHE_PATH_MAX	256
+#endif
+
+/*
+ * subdirectory handles kept for resolving request paths: slots and
+ * longest directory path kept
+ */
+#ifndef AWS_DIR_CACHE_SIZE
+#define AWS_DIR_CACHE_SIZE	64
+#endif
+#ifndef AWS_DIR_CACHE_PATH_MAX
+#define AWS_DIR_CACHE_PATH_MAX	256
+#endif
+
+/* directories the file watcher can follow */
+#ifndef AWS_FS_WATCH_MAX
+#define AWS_FS_WATCH_MAX	1024
+#endif
+
+/*
+ * busy-poll mode, for cores dedicated to the server: before sleeping, the
+ * event loop polls for events for AWS_BUSY_POLL_US, and the kernel polls
+ * the device queues for as long in each wait (AWS_BUSY_POLL_BUDGET
+ * packets at a time); 0 turns it off
+ */
+#ifndef AWS_BUSY_POLL_US
+#define AWS_BUSY_POLL_US	0
+#endif
+#ifndef AWS_BUSY_POLL_BUDGET
+#define AWS_BUSY_POLL_BUDGET	8
+#endif
+
+/* epoll events handled per loop iteration */
+#ifndef AWS_MAX_EVENTS
+#define AWS_MAX_EVENTS		64
+#endif
+
+/* transmission scheduler: bytes of credit per connection and round */
+#ifndef AWS_TX_QUANTUM
+#define AWS_TX_QUANTUM		(64 * 1024)
+#endif
+#ifndef AWS_TX_SMALL_FIRST	/* serve nearly finished responses first */
+#define AWS_TX_SMALL_FIRST	1
+#endif
+#ifndef AWS_TX_SMALL_SZ
+#define AWS_TX_SMALL_SZ		(16 * 1024)
+#endif
+
+/*
+ * blocks of the AIO engine: sized from the free send buffer space and the
+ * congestion window, measured again every AWS_TX_CHUNK_PROBE blocks
+ */
+#ifndef AWS_TX_CHUNK_MIN
+#define AWS_TX_CHUNK_MIN	(4 * 1024)
+#endif
+#ifndef AWS_TX_CHUNK_MAX
+#define AWS_TX_CHUNK_MAX	(256 * 1024)
+#endif
+#ifndef AWS_TX_CHUNK_PROBE
+#define AWS_TX_CHUNK_PROBE	8
+#endif
+
+/*
+ * TCP_NOTSENT_LOWAT on client sockets: a slow peer gets at most this many
+ * unsent bytes queued, instead of a whole autotuned send buffer (0: off)
+ */
+#ifndef AWS_NOTSENT_LOWAT
+#define AWS_NOTSENT_LOWAT	(128 * 1024)
+#endif
+
+/* pipes for the splice engine */
+#ifndef AWS_PIPE_SZ
+#define AWS_PIPE_SZ		(64 * 1024)
+#endif
+#ifndef AWS_PIPE_POOL_SIZE
+#define AWS_PIPE_POOL_SIZE	64
+#endif
+
+/*
+ * MSG_ZEROCOPY for bodies sent from the file cache's mappings, on sends
+ * of at least AWS_ZEROCOPY_MIN bytes (below that, copying is cheaper)
+ */
+#ifndef AWS_ZEROCOPY
+#define AWS_ZEROCOPY		0
+#endif
+#ifndef AWS_ZEROCOPY_MIN
+#define AWS_ZEROCOPY_MIN	(32 * 1024)
+#endif
+
+/* file cache (shared mmap) tunables */
+#ifndef AWS_CACHE_MAX_BYTES
+#define AWS_CACHE_MAX_BYTES	(256UL << 20)
+#endif
+#ifndef AWS_CACHE_MAX_ENTRIES
+#define AWS_CACHE_MAX_ENTRIES	4096
+#endif
+#ifndef AWS_CACHE_MAX_FILE_SZ	/* bigger files stay on their route's engine */
+#define AWS_CACHE_MAX_FILE_SZ	(4UL << 20)
+#endif
+#ifndef AWS_CACHE_BUCKETS
+#define AWS_CACHE_BUCKETS	1024
+#endif
+#ifndef AWS_CACHE_REVALIDATE	/* seconds between stat() checks of an entry */
+#define AWS_CACHE_REVALIDATE	60
+#endif
+#ifndef AWS_CACHE_POPULATE	/* prefault whole files with MAP_POPULATE */
+#define AWS_CACHE_POPULATE	0
+#endif
 
 #ifdef __cplusplus
 }
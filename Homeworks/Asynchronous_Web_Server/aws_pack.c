@@ -0,0 +1,238 @@
+/*
+ * aws_pack - build a packed archive out of a directory tree
+ *
+ * Usage: aws_pack <dir> <archive>
+ *
+ * Every regular file below dir is stored under its path relative to dir
+ * (e.g. "css/site.dat"). A file "x.gz" next to a file "x" is stored as the
+ * precompressed variant of "x" rather than on its own. The archive is
+ * written next to its final name and renamed over it, so a server that
+ * has the old one mapped keeps reading a consistent file.
+ *
+ * 2022, Operating Systems
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "util.h"
+#include "pack_format.h"
+
+#define PACK_ALIGN(x)	(((x) + PACK_DATA_ALIGN - 1) & \
+			~(uint64_t)(PACK_DATA_ALIGN - 1))
+
+struct input {
+	char *rel;		/* path relative to the root */
+	char *full;
+	uint64_t size;
+	struct input *gz;	/* precompressed variant */
+	int is_variant;
+};
+
+static struct input *inputs;
+static size_t num_inputs, cap_inputs;
+static size_t root_len;
+
+static int collect(const char *full, const struct stat *st, int type,
+		struct FTW *ftw)
+{
+	struct input *in;
+
+	if (type != FTW_F || !S_ISREG(st->st_mode))
+		return 0;
+
+	if (num_inputs == cap_inputs) {
+		cap_inputs = cap_inputs ? 2 * cap_inputs : 1024;
+		inputs = realloc(inputs, cap_inputs * sizeof(*inputs));
+		DIE(inputs == NULL, "realloc");
+	}
+
+	in = &inputs[num_inputs++];
+	memset(in, 0, sizeof(*in));
+	in->full = strdup(full);
+	in->rel = strdup(full + root_len);
+	DIE(in->full == NULL || in->rel == NULL, "strdup");
+	in->size = st->st_size;
+
+	return 0;
+}
+
+static int by_rel(const void *a, const void *b)
+{
+	return strcmp(((const struct input *)a)->rel,
+			((const struct input *)b)->rel);
+}
+
+/* Pair every "x.gz" with "x" (inputs are sorted by path). */
+
+static void match_variants(void)
+{
+	struct input key, *plain;
+	size_t i, len;
+
+	for (i = 0; i < num_inputs; i++) {
+		len = strlen(inputs[i].rel);
+		if (len <= 3 || strcmp(inputs[i].rel + len - 3, ".gz") != 0)
+			continue;
+
+		key.rel = strndup(inputs[i].rel, len - 3);
+		DIE(key.rel == NULL, "strndup");
+		plain = bsearch(&key, inputs, num_inputs, sizeof(*inputs),
+				by_rel);
+		free(key.rel);
+
+		if (plain != NULL) {
+			plain->gz = &inputs[i];
+			inputs[i].is_variant = 1;
+		}
+	}
+}
+
+/* Copy one file to out at off, returning the FNV-1a hash of its data. */
+
+static uint64_t copy_file(int out, const struct input *in, uint64_t off)
+{
+	uint64_t h = 14695981039346656037ULL, done = 0;
+	char buf[65536];
+	ssize_t n, i;
+	int fd;
+
+	fd = open(in->full, O_RDONLY);
+	DIE(fd < 0, in->full);
+
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		for (i = 0; i < n; i++) {
+			h ^= (unsigned char)buf[i];
+			h *= 1099511628211ULL;
+		}
+		DIE(pwrite(out, buf, n, off + done) != n, "pwrite");
+		done += n;
+	}
+	DIE(n < 0, "read");
+	close(fd);
+
+	if (done != in->size) {
+		fprintf(stderr, "%s changed while packing\n", in->full);
+		exit(EXIT_FAILURE);
+	}
+
+	return h;
+}
+
+int main(int argc, char **argv)
+{
+	struct pack_header hdr;
+	struct pack_entry *entries, *e;
+	uint32_t *slots, num_entries = 0, num_slots = 1, j, mask;
+	uint64_t paths_off, data_off, off;
+	char *tmp, *root;
+	size_t i, n;
+	int out;
+
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s <dir> <archive>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	/* stored paths are relative to root, which ends with '/' */
+	n = strlen(argv[1]);
+	root = malloc(n + 2);
+	DIE(root == NULL, "malloc");
+	memcpy(root, argv[1], n + 1);
+	if (n == 0 || root[n - 1] != '/')
+		strcat(root, "/");
+	root_len = strlen(root);
+
+	DIE(nftw(root, collect, 64, FTW_PHYS) < 0, "nftw");
+	qsort(inputs, num_inputs, sizeof(*inputs), by_rel);
+	match_variants();
+
+	for (i = 0; i < num_inputs; i++)
+		num_entries += !inputs[i].is_variant;
+
+	/* keep the index at most half full so probe runs stay short */
+	while (num_slots < 2 * (uint64_t)num_entries)
+		num_slots <<= 1;
+
+	slots = calloc(num_slots, sizeof(*slots));
+	entries = calloc(num_entries ? num_entries : 1, sizeof(*entries));
+	DIE(slots == NULL || entries == NULL, "calloc");
+
+	paths_off = sizeof(hdr) + (uint64_t)num_slots * sizeof(*slots) +
+		(uint64_t)num_entries * sizeof(*entries);
+	data_off = paths_off;
+	for (i = 0; i < num_inputs; i++)
+		if (!inputs[i].is_variant)
+			data_off += strlen(inputs[i].rel);
+	data_off = PACK_ALIGN(data_off);
+
+	tmp = malloc(strlen(argv[2]) + sizeof(".tmp"));
+	DIE(tmp == NULL, "malloc");
+	sprintf(tmp, "%s.tmp", argv[2]);
+	out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	DIE(out < 0, tmp);
+
+	/* data first, since the index carries the ETags */
+	mask = num_slots - 1;
+	off = data_off;
+	for (i = 0, e = entries; i < num_inputs; i++) {
+		struct input *in = &inputs[i];
+		size_t len = strlen(in->rel);
+
+		if (in->is_variant)
+			continue;
+
+		e->path_off = paths_off;
+		e->path_len = len;
+		e->hash = pack_hash(in->rel, len);
+		DIE(pwrite(out, in->rel, len, paths_off) != (ssize_t)len,
+				"pwrite");
+		paths_off += len;
+
+		e->off = off;
+		e->size = in->size;
+		e->etag = copy_file(out, in, off);
+		off = PACK_ALIGN(off + in->size);
+
+		if (in->gz != NULL) {
+			e->gz_off = off;
+			e->gz_size = in->gz->size;
+			copy_file(out, in->gz, off);
+			off = PACK_ALIGN(off + in->gz->size);
+		}
+
+		for (j = e->hash & mask; slots[j] != 0; j = (j + 1) & mask)
+			;
+		slots[j] = (e - entries) + 1;
+		e++;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, PACK_MAGIC, sizeof(hdr.magic));
+	hdr.version = PACK_VERSION;
+	hdr.num_entries = num_entries;
+	hdr.num_slots = num_slots;
+	hdr.size = off;
+
+	DIE(ftruncate(out, off) < 0, "ftruncate");
+	DIE(pwrite(out, &hdr, sizeof(hdr), 0) != sizeof(hdr), "pwrite");
+	DIE(pwrite(out, slots, num_slots * sizeof(*slots), sizeof(hdr)) !=
+			(ssize_t)(num_slots * sizeof(*slots)), "pwrite");
+	DIE(pwrite(out, entries, num_entries * sizeof(*entries),
+			sizeof(hdr) + num_slots * sizeof(*slots)) !=
+			(ssize_t)(num_entries * sizeof(*entries)), "pwrite");
+	DIE(fsync(out) < 0, "fsync");
+	DIE(close(out) < 0, "close");
+	DIE(rename(tmp, argv[2]) < 0, "rename");
+
+	printf("%s: %u files, %llu bytes\n", argv[2], num_entries,
+			(unsigned long long)off);
+
+	return 0;
+}
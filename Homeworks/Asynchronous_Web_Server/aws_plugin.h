@@ -0,0 +1,55 @@
+/*
+ * Plugin interface - request handlers loaded from shared objects
+ *
+ * A plugin is a shared object exporting
+ *
+ *	const struct aws_plugin aws_plugin = { AWS_PLUGIN_ABI, "name", handle };
+ *
+ * and is mounted on a route prefix in the server's route table. handle()
+ * runs on a plugin worker thread, never on the event loop, so it may
+ * block; it sends the body with aws_reply_write() as it goes and returns
+ * 0, or non-zero to fail the request (a 500 if nothing was written yet).
+ *
+ * 2022, Operating Systems
+ */
+
+#ifndef AWS_PLUGIN_H_
+#define AWS_PLUGIN_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#define AWS_PLUGIN_ABI		1
+
+struct aws_request {
+	const char *uri;	/* request target as received */
+	size_t uri_len;
+	const char *path;	/* the part after the route prefix */
+	size_t path_len;
+	int http_minor;		/* HTTP/1.x */
+};
+
+/* the response being built, owned by the server */
+struct aws_reply;
+
+struct aws_plugin {
+	int abi;		/* AWS_PLUGIN_ABI */
+	const char *name;
+	int (*handle)(const struct aws_request *req, struct aws_reply *reply);
+};
+
+/*
+ * Send len bytes of body. May wait until the client has taken earlier
+ * writes. Returns 0, or -1 if the client is gone and the handler should
+ * stop.
+ */
+int aws_reply_write(struct aws_reply *reply, const void *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AWS_PLUGIN_H_ */
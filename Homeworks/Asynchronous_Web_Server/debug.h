@@ -63,7 +63,8 @@ enum {
 			dprintf(format, ##__VA_ARGS__);		\
 	} while (0)
 #else
-#define dlog(level, format, ...)
+#define dlog(level, format, ...)				\
+	do { } while (0)
 #endif
 
 #ifdef __cplusplus
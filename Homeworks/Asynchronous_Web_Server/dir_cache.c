@@ -0,0 +1,245 @@
+/*
+ * Directory handles - request paths resolved beneath the docroots
+ *
+ * Every docroot is held open as an O_PATH directory handle, and a request
+ * path is opened relative to it with openat2(RESOLVE_BENEATH): the kernel
+ * only walks the part below the docroot, and ".." or a symlink leading out
+ * of it fails with EXDEV. Handles of the subdirectories requested lately
+ * are kept in a direct-mapped table of AWS_DIR_CACHE_SIZE slots, so a
+ * request under a hot subdirectory only resolves its last component.
+ *
+ * Resolution runs in the offload workers, so the table is shared: it is
+ * guarded by a mutex and a slot in use is reference counted. A flush (the
+ * file watcher saw a directory change) marks slots in use stale; the last
+ * user closes the handle.
+ *
+ * Kernels without openat2() (before 5.6) fall back to openat() after
+ * rejecting ".." components; symlinks are then followed as before.
+ *
+ * 2022, Operating Systems
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
+
+#include "aws.h"
+#include "dir_cache.h"
+
+struct dir_entry {
+	unsigned int hash;
+	unsigned int len;
+	int root;		/* docroot handle path is relative to */
+	int fd;			/* O_PATH handle, -1 if the slot is empty */
+	int refs;		/* resolutions using fd right now */
+	int stale;		/* flushed while in use */
+	char path[AWS_DIR_CACHE_PATH_MAX];
+};
+
+static struct dir_entry table[AWS_DIR_CACHE_SIZE] = {
+	[0 ... AWS_DIR_CACHE_SIZE - 1] = { .fd = -1 },
+};
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static atomic_int no_openat2;
+
+static unsigned int path_hash(int root, const char *path, size_t len)
+{
+	unsigned int h = 2166136261u;	/* FNV-1a */
+	size_t i;
+
+	h = (h ^ (unsigned int)root) * 16777619u;
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char)path[i];
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+/* Return 1 if path has a ".." component. */
+
+static int path_has_dotdot(const char *path)
+{
+	const char *p = path;
+
+	while ((p = strstr(p, "..")) != NULL) {
+		if ((p == path || p[-1] == '/') && (p[2] == '\0' || p[2] == '/'))
+			return 1;
+		p += 2;
+	}
+
+	return 0;
+}
+
+static int open_beneath(int dirfd, const char *path, int flags)
+{
+#ifdef SYS_openat2
+	struct open_how how = {
+		.flags = flags,
+		.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS,
+	};
+	int fd;
+
+	if (!atomic_load_explicit(&no_openat2, memory_order_relaxed)) {
+		fd = syscall(SYS_openat2, dirfd, path, &how, sizeof(how));
+		if (fd >= 0 || errno != ENOSYS)
+			return fd;
+		atomic_store_explicit(&no_openat2, 1, memory_order_relaxed);
+	}
+#endif
+
+	if (path[0] == '/' || path_has_dotdot(path)) {
+		errno = EXDEV;
+		return -1;
+	}
+
+	return openat(dirfd, path, flags);
+}
+
+static void entry_put(struct dir_entry *e)
+{
+	pthread_mutex_lock(&table_lock);
+	if (--e->refs == 0 && e->stale) {
+		close(e->fd);
+		e->fd = -1;
+		e->stale = 0;
+	}
+	pthread_mutex_unlock(&table_lock);
+}
+
+/*
+ * Get a handle on directory path (len bytes, NUL-terminated) below root.
+ * If it is cached, or could be cached, *e is set and the handle must be
+ * released with entry_put(); otherwise the caller closes it.
+ */
+
+static int dir_get(int root, const char *path, size_t len,
+		struct dir_entry **e)
+{
+	unsigned int h = path_hash(root, path, len);
+	struct dir_entry *slot = &table[h % AWS_DIR_CACHE_SIZE];
+	int fd;
+
+	*e = NULL;
+
+	pthread_mutex_lock(&table_lock);
+	if (slot->fd >= 0 && !slot->stale && slot->root == root &&
+			slot->hash == h && slot->len == len &&
+			memcmp(slot->path, path, len) == 0) {
+		slot->refs++;
+		*e = slot;
+		pthread_mutex_unlock(&table_lock);
+		return slot->fd;
+	}
+	pthread_mutex_unlock(&table_lock);
+
+	fd = open_beneath(root, path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0 || len >= AWS_DIR_CACHE_PATH_MAX)
+		return fd;
+
+	/* replace whatever the slot holds, unless someone is using it */
+	pthread_mutex_lock(&table_lock);
+	if (slot->refs == 0) {
+		if (slot->fd >= 0)
+			close(slot->fd);
+		slot->hash = h;
+		slot->len = len;
+		slot->root = root;
+		slot->fd = fd;
+		slot->refs = 1;
+		slot->stale = 0;
+		memcpy(slot->path, path, len);
+		*e = slot;
+	}
+	pthread_mutex_unlock(&table_lock);
+
+	return fd;
+}
+
+/* Open an O_PATH handle on docroot, or return -1. */
+
+int dir_root_open(const char *docroot)
+{
+	return open(docroot, O_PATH | O_DIRECTORY | O_CLOEXEC);
+}
+
+/*
+ * Open path (len bytes, NUL-terminated) beneath the directory handle root.
+ * Returns the file descriptor, or -1 with errno set; EXDEV means the path
+ * would leave root. May block: call it off the event loop.
+ */
+
+int dir_openat(int root, const char *path, size_t len, int flags)
+{
+	char dir[AWS_DIR_CACHE_PATH_MAX];
+	struct dir_entry *e;
+	const char *name;
+	size_t dir_len;
+	int dirfd, fd, err;
+
+	if (root < 0) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	/* URL paths are relative to the docroot, however they start */
+	while (len > 0 && *path == '/') {
+		path++;
+		len--;
+	}
+
+	name = memrchr(path, '/', len);
+	if (name == NULL)
+		return open_beneath(root, path, flags);
+
+	dir_len = name - path;
+	name++;
+	if (dir_len >= sizeof(dir))
+		return open_beneath(root, path, flags);
+
+	memcpy(dir, path, dir_len);
+	dir[dir_len] = '\0';
+
+	dirfd = dir_get(root, dir, dir_len, &e);
+	if (dirfd < 0)
+		return -1;
+
+	fd = open_beneath(dirfd, name, flags);
+	err = errno;
+	if (e != NULL)
+		entry_put(e);
+	else
+		close(dirfd);
+	errno = err;
+
+	return fd;
+}
+
+/* Close every cached handle; the ones in use are closed by their users. */
+
+void dir_cache_flush(void)
+{
+	size_t i;
+
+	pthread_mutex_lock(&table_lock);
+	for (i = 0; i < AWS_DIR_CACHE_SIZE; i++) {
+		struct dir_entry *e = &table[i];
+
+		if (e->fd < 0)
+			continue;
+		if (e->refs > 0) {
+			e->stale = 1;
+			continue;
+		}
+		close(e->fd);
+		e->fd = -1;
+	}
+	pthread_mutex_unlock(&table_lock);
+}
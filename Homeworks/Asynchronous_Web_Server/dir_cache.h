@@ -0,0 +1,24 @@
+/*
+ * Directory handles - request paths resolved beneath the docroots
+ *
+ * 2022, Operating Systems
+ */
+
+#ifndef DIR_CACHE_H_
+#define DIR_CACHE_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+int dir_root_open(const char *docroot);
+int dir_openat(int root, const char *path, size_t len, int flags);
+void dir_cache_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DIR_CACHE_H_ */
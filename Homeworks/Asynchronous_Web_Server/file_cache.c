@@ -0,0 +1,321 @@
+/*
+ * File cache - shared read-only mappings of hot files
+ *
+ * 2022, Operating Systems
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "aws.h"
+#include "debug.h"
+#include "file_cache.h"
+#include "stats.h"
+
+static struct cache_entry *buckets[AWS_CACHE_BUCKETS];
+
+/* least recently used entry at the head, most recently used at the tail */
+static struct cache_entry *lru_head;
+static struct cache_entry *lru_tail;
+
+static size_t cache_bytes;
+static size_t cache_entries;
+
+/* bumped by every invalidation, see file_cache_insert() */
+static unsigned int generation;
+
+static unsigned int path_hash(const char *path, size_t len)
+{
+	unsigned int h = 2166136261u;	/* FNV-1a */
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char)path[i];
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+static void lru_unlink(struct cache_entry *e)
+{
+	if (e->lru_prev)
+		e->lru_prev->lru_next = e->lru_next;
+	else
+		lru_head = e->lru_next;
+
+	if (e->lru_next)
+		e->lru_next->lru_prev = e->lru_prev;
+	else
+		lru_tail = e->lru_prev;
+
+	e->lru_prev = e->lru_next = NULL;
+}
+
+static void lru_append(struct cache_entry *e)
+{
+	e->lru_prev = lru_tail;
+	e->lru_next = NULL;
+
+	if (lru_tail)
+		lru_tail->lru_next = e;
+	else
+		lru_head = e;
+	lru_tail = e;
+}
+
+static void entry_free(struct cache_entry *e)
+{
+	if (e->addr != NULL)
+		munmap(e->addr, e->size);
+	free(e->path);
+	free(e);
+}
+
+/*
+ * Take an entry out of the table. It is freed right away if no connection
+ * uses it, otherwise when the last one releases it.
+ */
+
+static void entry_remove(struct cache_entry *e)
+{
+	struct cache_entry **pp = &buckets[e->hash % AWS_CACHE_BUCKETS];
+
+	while (*pp != e)
+		pp = &(*pp)->next;
+	*pp = e->next;
+
+	lru_unlink(e);
+	cache_bytes -= e->size;
+	cache_entries--;
+	aws_stats.cache_bytes = cache_bytes;
+
+	e->stale = 1;
+	if (e->refs == 0)
+		entry_free(e);
+}
+
+/* make room for size more bytes by dropping unused entries, oldest first */
+static void cache_evict(size_t size)
+{
+	struct cache_entry *e = lru_head, *next;
+
+	while (e != NULL && (cache_bytes + size > AWS_CACHE_MAX_BYTES ||
+			cache_entries >= AWS_CACHE_MAX_ENTRIES)) {
+		next = e->lru_next;
+		if (e->refs == 0) {
+			entry_remove(e);
+			aws_stats.cache_evictions++;
+		}
+		e = next;
+	}
+}
+
+/*
+ * Changes are normally reported by the file watcher, which invalidates
+ * the entry. As a fallback (say, a directory that could not be watched)
+ * entries are also checked against the file at most once every
+ * AWS_CACHE_REVALIDATE seconds; a changed file drops the entry. The
+ * stat() runs in the offload pool, and the entry keeps being served
+ * until its result is in. The check holds a reference, so the entry
+ * outlives it even if it is evicted meanwhile.
+ */
+
+static void entry_checked(struct offload_job *job)
+{
+	struct cache_entry *e = (struct cache_entry *)
+		((char *)job - offsetof(struct cache_entry, check));
+	struct stat *st = &job->st;
+
+	e->checking = 0;
+	if (!e->stale) {
+		if (job->err != 0 || st->st_dev != e->dev ||
+				st->st_ino != e->ino ||
+				st->st_mtime != e->mtime ||
+				(size_t)st->st_size != e->size)
+			entry_remove(e);
+		else
+			e->validated = time(NULL);
+	}
+
+	file_cache_release(e);
+}
+
+static void entry_revalidate(struct cache_entry *e)
+{
+	if (e->checking || time(NULL) - e->validated < AWS_CACHE_REVALIDATE)
+		return;
+
+	e->check.op = OFFLOAD_STAT;
+	e->check.path = e->path;
+	e->check.done = entry_checked;
+	e->checking = 1;
+	e->refs++;
+
+	if (offload_submit(&e->check) == 0)
+		return;
+
+	/* the pool is busy: try again on the next hit */
+	if (AWS_OFFLOAD_THREADS > 0) {
+		e->checking = 0;
+		e->refs--;
+		return;
+	}
+
+	offload_run(&e->check);
+	entry_checked(&e->check);
+}
+
+/*
+ * Look path up (len bytes). On a hit the entry is referenced and must be
+ * given back with file_cache_release().
+ */
+
+struct cache_entry *file_cache_lookup(const char *path, size_t len)
+{
+	unsigned int hash = path_hash(path, len);
+	struct cache_entry *e;
+
+	for (e = buckets[hash % AWS_CACHE_BUCKETS]; e != NULL; e = e->next) {
+		if (e->hash != hash || e->path_len != len ||
+				memcmp(e->path, path, len) != 0)
+			continue;
+
+		entry_revalidate(e);
+		if (e->stale)
+			break;
+
+		lru_unlink(e);
+		lru_append(e);
+		e->refs++;
+		aws_stats.cache_hits++;
+
+		return e;
+	}
+
+	aws_stats.cache_misses++;
+
+	return NULL;
+}
+
+/*
+ * Callers that open a file off the event loop read the generation before
+ * the open() and pass it to file_cache_insert(). If an invalidation came
+ * in between, the file may have been replaced after it was opened, so it
+ * is not cached.
+ */
+
+unsigned int file_cache_generation(void)
+{
+	return generation;
+}
+
+/*
+ * Map the file open on fd and add it to the cache under path. The caller
+ * keeps ownership of fd. Returns a referenced entry, or NULL if the file
+ * is too big for the cache, could not be mapped or changed since gen.
+ */
+
+struct cache_entry *file_cache_insert(const char *path, size_t len, int fd,
+		unsigned int gen)
+{
+	struct cache_entry *e;
+	struct stat st;
+	int flags = MAP_SHARED;
+
+	if (gen != generation)
+		return NULL;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return NULL;
+	if ((size_t)st.st_size > AWS_CACHE_MAX_FILE_SZ)
+		return NULL;
+
+	cache_evict(st.st_size);
+	if (cache_bytes + st.st_size > AWS_CACHE_MAX_BYTES ||
+			cache_entries >= AWS_CACHE_MAX_ENTRIES)
+		return NULL;
+
+	e = calloc(1, sizeof(*e));
+	if (e == NULL)
+		return NULL;
+
+	e->path = malloc(len + 1);
+	if (e->path == NULL) {
+		free(e);
+		return NULL;
+	}
+	memcpy(e->path, path, len);
+	e->path[len] = '\0';
+	e->path_len = len;
+	e->hash = path_hash(path, len);
+
+	e->size = st.st_size;
+	e->dev = st.st_dev;
+	e->ino = st.st_ino;
+	e->mtime = st.st_mtime;
+	e->validated = time(NULL);
+
+	if (AWS_CACHE_POPULATE)
+		flags |= MAP_POPULATE;
+
+	/* mmap() refuses empty mappings; an empty file needs none */
+	if (e->size > 0) {
+		e->addr = mmap(NULL, e->size, PROT_READ, flags, fd, 0);
+		if (e->addr == MAP_FAILED) {
+			dlog(LOG_WARNING, "mmap %s failed\n", e->path);
+			free(e->path);
+			free(e);
+			return NULL;
+		}
+		madvise(e->addr, e->size, MADV_WILLNEED);
+	}
+
+	e->next = buckets[e->hash % AWS_CACHE_BUCKETS];
+	buckets[e->hash % AWS_CACHE_BUCKETS] = e;
+	lru_append(e);
+	cache_bytes += e->size;
+	cache_entries++;
+	aws_stats.cache_bytes = cache_bytes;
+
+	e->refs = 1;
+
+	return e;
+}
+
+void file_cache_release(struct cache_entry *e)
+{
+	e->refs--;
+	if (e->refs == 0 && e->stale)
+		entry_free(e);
+}
+
+/* The file at path changed: drop its entry, if any. */
+
+void file_cache_invalidate(const char *path, size_t len)
+{
+	unsigned int hash = path_hash(path, len);
+	struct cache_entry *e;
+
+	generation++;
+
+	for (e = buckets[hash % AWS_CACHE_BUCKETS]; e != NULL; e = e->next) {
+		if (e->hash == hash && e->path_len == len &&
+				memcmp(e->path, path, len) == 0) {
+			entry_remove(e);
+			return;
+		}
+	}
+}
+
+void file_cache_flush(void)
+{
+	generation++;
+
+	while (lru_head != NULL)
+		entry_remove(lru_head);
+}
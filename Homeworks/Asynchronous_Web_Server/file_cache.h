@@ -0,0 +1,60 @@
+/*
+ * File cache - shared read-only mappings of hot files
+ *
+ * 2022, Operating Systems
+ */
+
+#ifndef FILE_CACHE_H_
+#define FILE_CACHE_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "offload.h"
+
+/*
+ * One mapped file. Entries are shared by every connection sending the
+ * file; refs counts those connections and the mapping is only dropped
+ * once an evicted (or stale) entry is no longer referenced.
+ */
+struct cache_entry {
+	char *path;
+	size_t path_len;
+	unsigned int hash;
+
+	void *addr;
+	size_t size;
+
+	dev_t dev;
+	ino_t ino;
+	time_t mtime;
+	time_t validated;
+	struct offload_job check;	/* stat() of the file, off the loop */
+	int checking;
+
+	int refs;
+	int stale;
+
+	struct cache_entry *next;	/* hash chain */
+	struct cache_entry *lru_prev;
+	struct cache_entry *lru_next;
+};
+
+struct cache_entry *file_cache_lookup(const char *path, size_t len);
+unsigned int file_cache_generation(void);
+struct cache_entry *file_cache_insert(const char *path, size_t len, int fd,
+		unsigned int gen);
+void file_cache_release(struct cache_entry *e);
+void file_cache_invalidate(const char *path, size_t len);
+void file_cache_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FILE_CACHE_H_ */
@@ -0,0 +1,69 @@
+/*
+ * File hints - tell the page cache how served files are read
+ *
+ * Every response reads its file once, front to back, so on open the file
+ * is marked sequential (larger kernel readahead) and the first
+ * AWS_READAHEAD_WINDOW bytes are requested at once, before the first
+ * send. Files of at least AWS_FADV_DONTNEED_MIN bytes are dropped from the
+ * page cache once sent, so that a large one-shot download does not push
+ * the small hot files out. Each policy is disabled by setting it to 0.
+ *
+ * 2022, Operating Systems
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+
+#include "aws.h"
+#include "file_hints.h"
+
+#define MIN(a,b) (((a)<(b))?(a):(b))
+
+/*
+ * Tell whether the start of the file is in the page cache, by reading one
+ * byte with RWF_NOWAIT. Returns 1 if it is, 0 if not and -1 if that cannot
+ * be told (empty file, probing disabled or not supported).
+ */
+
+int file_hints_probe(int fd, off_t size)
+{
+#if AWS_PAGE_CACHE_PROBE && defined(RWF_NOWAIT)
+	char c;
+	struct iovec iov = { .iov_base = &c, .iov_len = 1 };
+
+	if (size <= 0)
+		return -1;
+
+	if (preadv2(fd, &iov, 1, 0, RWF_NOWAIT) == 1)
+		return 1;
+
+	return errno == EAGAIN ? 0 : -1;
+#else
+	return -1;
+#endif
+}
+
+/* Hints for a file that is about to be sent; may block, so runs offloaded. */
+
+void file_hints_open(int fd, off_t size)
+{
+	if (AWS_FADV_SEQUENTIAL)
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	if (AWS_READAHEAD_WINDOW > 0 && size > 0)
+		readahead(fd, 0, MIN((size_t)size, AWS_READAHEAD_WINDOW));
+}
+
+/*
+ * Whether a file of size bytes should leave the page cache once it has
+ * been sent. Dropping the pages may block, so the caller offloads the
+ * POSIX_FADV_DONTNEED.
+ */
+
+int file_hints_drop(off_t size)
+{
+	return AWS_FADV_DONTNEED_MIN > 0 &&
+		size >= (off_t)AWS_FADV_DONTNEED_MIN;
+}
@@ -0,0 +1,24 @@
+/*
+ * File hints - tell the page cache how served files are read
+ *
+ * 2022, Operating Systems
+ */
+
+#ifndef FILE_HINTS_H_
+#define FILE_HINTS_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <sys/types.h>
+
+int file_hints_probe(int fd, off_t size);
+void file_hints_open(int fd, off_t size);
+int file_hints_drop(off_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FILE_HINTS_H_ */
@@ -0,0 +1,258 @@
+/*
+ * File watcher - inotify on the docroots, for cache invalidation
+ *
+ * The inotify descriptor sits in the server's epoll set and events are
+ * read on the event loop, in fs_watch_handle(). Every directory below a
+ * docroot is watched, including ones created later. An event on a file
+ * (created, written, attributes changed, deleted, moved in or out)
+ * invalidates that path in every registered cache. Events on directories
+ * change whole subtrees and flush the caches, and so does an overflow of
+ * the kernel's event queue, after which events are known to be lost.
+ *
+ * 2022, Operating Systems
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "aws.h"
+#include "debug.h"
+#include "fs_watch.h"
+#include "stats.h"
+
+#define FS_WATCH_EVENTS	(IN_CREATE | IN_MOVED_TO | IN_MODIFY | \
+			 IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE | \
+			 IN_MOVED_FROM | IN_DELETE_SELF | IN_MOVE_SELF)
+#define FS_WATCH_OPS	8
+
+struct fs_watch {
+	int wd;			/* -1 if the slot is free */
+	char *dir;		/* ends with '/' */
+	size_t dir_len;
+};
+
+static struct fs_watch watches[AWS_FS_WATCH_MAX];
+static int num_watches;
+static int inotify_fd = -1;
+
+static const struct fs_watch_ops *ops[FS_WATCH_OPS];
+static int num_ops;
+
+/* Returns the inotify descriptor to watch for EPOLLIN, -1 on failure. */
+
+int fs_watch_init(void)
+{
+	inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+	return inotify_fd;
+}
+
+int fs_watch_register(const struct fs_watch_ops *o)
+{
+	if (num_ops == FS_WATCH_OPS)
+		return -1;
+
+	ops[num_ops++] = o;
+
+	return 0;
+}
+
+static void caches_invalidate(const char *path, size_t len)
+{
+	int i;
+
+	for (i = 0; i < num_ops; i++)
+		if (ops[i]->invalidate != NULL)
+			ops[i]->invalidate(path, len);
+}
+
+static void caches_flush(void)
+{
+	int i;
+
+	for (i = 0; i < num_ops; i++)
+		ops[i]->flush();
+}
+
+static struct fs_watch *watch_find(int wd)
+{
+	int i;
+
+	for (i = 0; i < num_watches; i++)
+		if (watches[i].wd == wd)
+			return &watches[i];
+
+	return NULL;
+}
+
+static void watch_forget(struct fs_watch *w)
+{
+	free(w->dir);
+	w->dir = NULL;
+	w->wd = -1;
+}
+
+static struct fs_watch *watch_slot(void)
+{
+	int i;
+
+	for (i = 0; i < num_watches; i++)
+		if (watches[i].wd < 0)
+			return &watches[i];
+
+	if (num_watches == AWS_FS_WATCH_MAX)
+		return NULL;
+
+	return &watches[num_watches++];
+}
+
+/*
+ * Watch directory dir (given with a trailing '/') and every directory
+ * below it. Returns 0, or -1 if some directory could not be watched.
+ */
+
+int fs_watch_add(const char *dir)
+{
+	char sub[PATH_MAX];
+	size_t dir_len = strlen(dir), name_len;
+	struct fs_watch *w;
+	struct dirent *de;
+	struct stat st;
+	DIR *d;
+	int wd, rc = 0;
+
+	wd = inotify_add_watch(inotify_fd, dir, FS_WATCH_EVENTS | IN_ONLYDIR);
+	if (wd < 0)
+		return -1;
+
+	/* the same directory reached twice keeps its watch descriptor */
+	w = watch_find(wd);
+	if (w == NULL) {
+		w = watch_slot();
+		if (w == NULL) {
+			inotify_rm_watch(inotify_fd, wd);
+			return -1;
+		}
+		w->dir = strdup(dir);
+		if (w->dir == NULL) {
+			w->wd = -1;
+			inotify_rm_watch(inotify_fd, wd);
+			return -1;
+		}
+		w->wd = wd;
+		w->dir_len = dir_len;
+	}
+
+	d = opendir(dir);
+	if (d == NULL)
+		return -1;
+
+	while ((de = readdir(d)) != NULL) {
+		if (strcmp(de->d_name, ".") == 0 ||
+				strcmp(de->d_name, "..") == 0)
+			continue;
+
+		name_len = strlen(de->d_name);
+		if (dir_len + name_len + 2 > sizeof(sub)) {
+			rc = -1;
+			continue;
+		}
+		memcpy(sub, dir, dir_len);
+		memcpy(sub + dir_len, de->d_name, name_len);
+		sub[dir_len + name_len] = '\0';
+
+		if (de->d_type != DT_DIR && (de->d_type != DT_UNKNOWN ||
+				lstat(sub, &st) < 0 || !S_ISDIR(st.st_mode)))
+			continue;
+
+		sub[dir_len + name_len] = '/';
+		sub[dir_len + name_len + 1] = '\0';
+		if (fs_watch_add(sub) < 0)
+			rc = -1;
+	}
+	closedir(d);
+
+	return rc;
+}
+
+static void fs_watch_event(const struct inotify_event *ev)
+{
+	char path[PATH_MAX];
+	struct fs_watch *w;
+	size_t name_len;
+
+	aws_stats.fs_watch_events++;
+
+	if (ev->mask & IN_Q_OVERFLOW) {
+		dlog(LOG_INFO, "inotify queue overflow, flushing caches\n");
+		aws_stats.fs_watch_overflows++;
+		caches_flush();
+		return;
+	}
+
+	w = watch_find(ev->wd);
+	if (w == NULL)
+		return;
+
+	/* the watched directory itself is gone or was moved elsewhere */
+	if (ev->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+		if (!(ev->mask & IN_IGNORED))
+			inotify_rm_watch(inotify_fd, w->wd);
+		watch_forget(w);
+		caches_flush();
+		return;
+	}
+
+	if (ev->len == 0)
+		return;
+
+	name_len = strlen(ev->name);
+	if (w->dir_len + name_len + 2 > sizeof(path)) {
+		caches_flush();
+		return;
+	}
+	memcpy(path, w->dir, w->dir_len);
+	memcpy(path + w->dir_len, ev->name, name_len + 1);
+
+	if (ev->mask & IN_ISDIR) {
+		/* a directory moved or created here brings a subtree along */
+		if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+			path[w->dir_len + name_len] = '/';
+			path[w->dir_len + name_len + 1] = '\0';
+			if (fs_watch_add(path) < 0)
+				dlog(LOG_ERR, "Cannot watch %s\n", path);
+		}
+		caches_flush();
+		return;
+	}
+
+	caches_invalidate(path, w->dir_len + name_len);
+}
+
+/* Read and apply all queued events. */
+
+void fs_watch_handle(void)
+{
+	char buf[4096]
+		__attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	ssize_t len;
+	char *p;
+
+	for (;;) {
+		len = read(inotify_fd, buf, sizeof(buf));
+		if (len <= 0)
+			return;
+
+		for (p = buf; p < buf + len; p += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *)p;
+			fs_watch_event(ev);
+		}
+	}
+}
@@ -0,0 +1,36 @@
+/*
+ * File watcher - inotify on the docroots, for cache invalidation
+ *
+ * 2022, Operating Systems
+ */
+
+#ifndef FS_WATCH_H_
+#define FS_WATCH_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/*
+ * A cache that keeps anything derived from files under the docroots
+ * registers these: invalidate() drops what was derived from path, flush()
+ * drops everything. A cache holding only directories may leave
+ * invalidate() NULL, since directory events always flush.
+ */
+struct fs_watch_ops {
+	void (*invalidate)(const char *path, size_t len);
+	void (*flush)(void);
+};
+
+int fs_watch_init(void);
+int fs_watch_register(const struct fs_watch_ops *ops);
+int fs_watch_add(const char *dir);
+void fs_watch_handle(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FS_WATCH_H_ */
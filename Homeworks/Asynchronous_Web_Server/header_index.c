@@ -0,0 +1,125 @@
+/*
+ * Request header index - zero-copy slices for the headers aws acts on
+ *
+ * 2022, Operating Systems
+ */
+
+#include <string.h>
+#include <strings.h>
+
+#include "header_index.h"
+
+/*
+ * Perfect hash over the interesting header names: header length mixed with
+ * the (lowercased) first character gives a distinct slot for each of them.
+ * Any other name either lands on an empty slot or fails the length check,
+ * so most uninteresting headers are rejected without a string compare.
+ */
+#define HEADER_HASH_SIZE	16
+#define HEADER_HASH(len, c)	(((len) ^ ((unsigned char)(c) | 0x20)) & \
+				 (HEADER_HASH_SIZE - 1))
+
+struct header_name {
+	const char *name;
+	size_t len;
+	int id;
+};
+
+static const struct header_name header_names[HEADER_HASH_SIZE] = {
+	[HEADER_HASH(4, 'h')]	= { "host", 4, HEADER_HOST },
+	[HEADER_HASH(5, 'r')]	= { "range", 5, HEADER_RANGE },
+	[HEADER_HASH(13, 'i')]	= { "if-none-match", 13, HEADER_IF_NONE_MATCH },
+	[HEADER_HASH(17, 'i')]	= { "if-modified-since", 17,
+					HEADER_IF_MODIFIED_SINCE },
+	[HEADER_HASH(15, 'a')]	= { "accept-encoding", 15,
+					HEADER_ACCEPT_ENCODING },
+	[HEADER_HASH(10, 'c')]	= { "connection", 10, HEADER_CONNECTION },
+};
+
+static int header_lookup(const char *name, size_t len)
+{
+	const struct header_name *h;
+
+	if (len == 0)
+		return -1;
+
+	h = &header_names[HEADER_HASH(len, name[0])];
+	if (h->len != len || strncasecmp(h->name, name, len) != 0)
+		return -1;
+
+	return h->id;
+}
+
+void header_index_init(struct header_index *idx, const char *base)
+{
+	memset(idx, 0, sizeof(*idx));
+	idx->base = base;
+	idx->current = -1;
+	idx->in_value = 1;
+}
+
+/* The receive buffer moved; slices are offsets, so only base changes. */
+
+void header_index_rebase(struct header_index *idx, const char *base)
+{
+	idx->base = base;
+}
+
+/*
+ * The parser may hand a name or a value over in several pieces (one per
+ * http_parser_execute() call). Pieces are contiguous in the receive buffer,
+ * so continuing a slice only means growing its length.
+ */
+
+void header_index_field(struct header_index *idx, const char *at, size_t len)
+{
+	if (idx->in_value) {
+		idx->field.off = at - idx->base;
+		idx->field.len = 0;
+		idx->in_value = 0;
+	}
+
+	idx->field.len += len;
+}
+
+void header_index_value(struct header_index *idx, const char *at, size_t len)
+{
+	struct header_slice *s;
+
+	if (!idx->in_value) {
+		idx->in_value = 1;
+		idx->current = header_lookup(idx->base + idx->field.off,
+				idx->field.len);
+
+		/* keep the first occurrence of a repeated header */
+		if (idx->current < 0 || (idx->present & (1u << idx->current))) {
+			idx->current = -1;
+			return;
+		}
+
+		idx->present |= 1u << idx->current;
+		s = &idx->slices[idx->current];
+		s->off = at - idx->base;
+		s->len = len;
+		return;
+	}
+
+	if (idx->current >= 0)
+		idx->slices[idx->current].len += len;
+}
+
+/*
+ * Return a pointer to the value of header id (not NUL-terminated) and store
+ * its length in len, or return NULL if the request did not carry it.
+ */
+
+const char *header_index_get(const struct header_index *idx,
+		enum header_id id, size_t *len)
+{
+	if (!(idx->present & (1u << id)))
+		return NULL;
+
+	*len = idx->slices[id].len;
+
+	return idx->base + idx->slices[id].off;
+}
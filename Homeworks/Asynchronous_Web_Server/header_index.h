@@ -0,0 +1,57 @@
+/*
+ * Request header index - zero-copy slices for the headers aws acts on
+ *
+ * 2022, Operating Systems
+ */
+
+#ifndef HEADER_INDEX_H_
+#define HEADER_INDEX_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* headers the server looks at; everything else is skipped without copying */
+enum header_id {
+	HEADER_HOST,
+	HEADER_RANGE,
+	HEADER_IF_NONE_MATCH,
+	HEADER_IF_MODIFIED_SINCE,
+	HEADER_ACCEPT_ENCODING,
+	HEADER_CONNECTION,
+	HEADER_COUNT
+};
+
+/*
+ * Slices are kept as offsets from the start of the receive buffer, so the
+ * index stays valid if the buffer is moved.
+ */
+struct header_slice {
+	uint32_t off;
+	uint32_t len;
+};
+
+struct header_index {
+	const char *base;
+	struct header_slice field;	/* name currently being parsed */
+	int current;			/* header_id of the value, -1 if ignored */
+	int in_value;
+	unsigned int present;		/* bitmask of (1 << header_id) */
+	struct header_slice slices[HEADER_COUNT];
+};
+
+void header_index_init(struct header_index *idx, const char *base);
+void header_index_rebase(struct header_index *idx, const char *base);
+void header_index_field(struct header_index *idx, const char *at, size_t len);
+void header_index_value(struct header_index *idx, const char *at, size_t len);
+const char *header_index_get(const struct header_index *idx,
+		enum header_id id, size_t *len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HEADER_INDEX_H_ */
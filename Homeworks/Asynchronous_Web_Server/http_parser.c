@@ -22,6 +22,13 @@
 #include <assert.h>
 #include <stddef.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define HTTP_PARSER_SIMD 1
+# include <immintrin.h>
+#else
+# define HTTP_PARSER_SIMD 0
+#endif
+
 
 #ifndef MIN
 # define MIN(a,b) ((a) < (b) ? (a) : (b))
@@ -318,6 +325,203 @@ enum flags
 #endif
 
 
+/* Bulk scanners for the hot states (url, header field, header value).
+ *
+ * Each one returns a pointer to the first byte in [p, pe) that is not a
+ * "plain" byte for its state, or pe if the whole run is plain. Plain bytes
+ * are the ones the state machine would just skip over:
+ *
+ *   url    - normal_url_char[c] != 0 (stops at SP, CR, LF, '?', '#', ...)
+ *   field  - tokens[c] != 0 (stops at ':', CR, LF and other separators)
+ *   value  - anything but CR and LF
+ *
+ * The SSE2 and AVX2 versions must agree byte for byte with the tables above;
+ * the implementation is picked once, by runtime CPU detection.
+ */
+typedef const char *(*http_scan_fn) (const char *p, const char *pe);
+
+struct http_scanners {
+  http_scan_fn url;
+  http_scan_fn field;
+  http_scan_fn value;
+};
+
+static const char *scan_url_scalar (const char *p, const char *pe)
+{
+  while (p != pe && normal_url_char[(unsigned char)*p]) p++;
+  return p;
+}
+
+static const char *scan_field_scalar (const char *p, const char *pe)
+{
+  while (p != pe && TOKEN(*p)) p++;
+  return p;
+}
+
+static const char *scan_value_scalar (const char *p, const char *pe)
+{
+  while (p != pe && *p != CR && *p != LF) p++;
+  return p;
+}
+
+#if HTTP_PARSER_SIMD
+
+/* Byte ranges are tested with signed compares, so that bytes >= 0x80 (which
+ * are never plain in url or field states) fall below every lower bound.
+ */
+#define SSE_IN_RANGE(v, lo, hi)                                      \
+  _mm_and_si128(_mm_cmpgt_epi8((v), _mm_set1_epi8((lo) - 1)),        \
+                _mm_cmplt_epi8((v), _mm_set1_epi8((hi) + 1)))
+
+#define SSE_EQ(v, c) _mm_cmpeq_epi8((v), _mm_set1_epi8(c))
+
+__attribute__((target("sse2")))
+static const char *scan_url_sse2 (const char *p, const char *pe)
+{
+  while (pe - p >= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i bad = _mm_cmplt_epi8(v, _mm_set1_epi8(33));
+    bad = _mm_or_si128(bad, SSE_EQ(v, '#'));
+    bad = _mm_or_si128(bad, SSE_EQ(v, '?'));
+    bad = _mm_or_si128(bad, SSE_EQ(v, 127));
+    int mask = _mm_movemask_epi8(bad);
+    if (mask) return p + __builtin_ctz(mask);
+    p += 16;
+  }
+  return scan_url_scalar(p, pe);
+}
+
+__attribute__((target("sse2")))
+static const char *scan_field_sse2 (const char *p, const char *pe)
+{
+  while (pe - p >= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i bad = _mm_cmplt_epi8(v, _mm_set1_epi8(32));
+    bad = _mm_or_si128(bad, SSE_IN_RANGE(v, '(', ')'));
+    bad = _mm_or_si128(bad, SSE_EQ(v, ','));
+    bad = _mm_or_si128(bad, SSE_IN_RANGE(v, ':', '@'));
+    bad = _mm_or_si128(bad, SSE_IN_RANGE(v, '[', ']'));
+    bad = _mm_or_si128(bad, SSE_EQ(v, '{'));
+    bad = _mm_or_si128(bad, SSE_EQ(v, 127));
+    int mask = _mm_movemask_epi8(bad);
+    if (mask) return p + __builtin_ctz(mask);
+    p += 16;
+  }
+  return scan_field_scalar(p, pe);
+}
+
+__attribute__((target("sse2")))
+static const char *scan_value_sse2 (const char *p, const char *pe)
+{
+  while (pe - p >= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i bad = _mm_or_si128(SSE_EQ(v, CR), SSE_EQ(v, LF));
+    int mask = _mm_movemask_epi8(bad);
+    if (mask) return p + __builtin_ctz(mask);
+    p += 16;
+  }
+  return scan_value_scalar(p, pe);
+}
+
+#define AVX_IN_RANGE(v, lo, hi)                                      \
+  _mm256_and_si256(_mm256_cmpgt_epi8((v), _mm256_set1_epi8((lo) - 1)), \
+                   _mm256_cmpgt_epi8(_mm256_set1_epi8((hi) + 1), (v)))
+
+#define AVX_EQ(v, c) _mm256_cmpeq_epi8((v), _mm256_set1_epi8(c))
+
+#define AVX_LT(v, c) _mm256_cmpgt_epi8(_mm256_set1_epi8(c), (v))
+
+__attribute__((target("avx2")))
+static const char *scan_url_avx2 (const char *p, const char *pe)
+{
+  while (pe - p >= 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    __m256i bad = AVX_LT(v, 33);
+    bad = _mm256_or_si256(bad, AVX_EQ(v, '#'));
+    bad = _mm256_or_si256(bad, AVX_EQ(v, '?'));
+    bad = _mm256_or_si256(bad, AVX_EQ(v, 127));
+    unsigned mask = (unsigned)_mm256_movemask_epi8(bad);
+    if (mask) return p + __builtin_ctz(mask);
+    p += 32;
+  }
+  return scan_url_sse2(p, pe);
+}
+
+__attribute__((target("avx2")))
+static const char *scan_field_avx2 (const char *p, const char *pe)
+{
+  while (pe - p >= 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    __m256i bad = AVX_LT(v, 32);
+    bad = _mm256_or_si256(bad, AVX_IN_RANGE(v, '(', ')'));
+    bad = _mm256_or_si256(bad, AVX_EQ(v, ','));
+    bad = _mm256_or_si256(bad, AVX_IN_RANGE(v, ':', '@'));
+    bad = _mm256_or_si256(bad, AVX_IN_RANGE(v, '[', ']'));
+    bad = _mm256_or_si256(bad, AVX_EQ(v, '{'));
+    bad = _mm256_or_si256(bad, AVX_EQ(v, 127));
+    unsigned mask = (unsigned)_mm256_movemask_epi8(bad);
+    if (mask) return p + __builtin_ctz(mask);
+    p += 32;
+  }
+  return scan_field_sse2(p, pe);
+}
+
+__attribute__((target("avx2")))
+static const char *scan_value_avx2 (const char *p, const char *pe)
+{
+  while (pe - p >= 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    __m256i bad = _mm256_or_si256(AVX_EQ(v, CR), AVX_EQ(v, LF));
+    unsigned mask = (unsigned)_mm256_movemask_epi8(bad);
+    if (mask) return p + __builtin_ctz(mask);
+    p += 32;
+  }
+  return scan_value_sse2(p, pe);
+}
+
+#endif /* HTTP_PARSER_SIMD */
+
+
+static struct http_scanners scan =
+  { scan_url_scalar, scan_field_scalar, scan_value_scalar };
+
+
+static void http_scanners_init (void)
+{
+  static int initialized;
+
+  if (initialized) return;
+  initialized = 1;
+
+#if HTTP_PARSER_SIMD
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2")) {
+    scan.url = scan_url_avx2;
+    scan.field = scan_field_avx2;
+    scan.value = scan_value_avx2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    scan.url = scan_url_sse2;
+    scan.field = scan_field_sse2;
+    scan.value = scan_value_sse2;
+  }
+#endif
+}
+
+
+/* Skip the run of plain bytes that follows p (which is itself plain) and
+ * leave p on the last one, so that the main loop's p++ lands on the
+ * delimiter. Header byte accounting is kept in sync with the skip.
+ */
+#define SKIP_PLAIN(KIND)                                             \
+do {                                                                 \
+  const char *q_ = scan.KIND(p + 1, pe);                             \
+  nread += q_ - (p + 1);                                             \
+  if (nread > HTTP_MAX_HEADER_SIZE) goto error;                      \
+  p = q_ - 1;                                                        \
+} while (0)
+
+
 size_t http_parser_execute (http_parser *parser,
                             const http_parser_settings *settings,
                             const char *data,
@@ -749,7 +953,10 @@ size_t http_parser_execute (http_parser *parser,
 
       case s_req_path:
       {
-        if (normal_url_char[(unsigned char)ch]) break;
+        if (normal_url_char[(unsigned char)ch]) {
+          SKIP_PLAIN(url);
+          break;
+        }
 
         switch (ch) {
           case ' ':
@@ -823,7 +1030,10 @@ size_t http_parser_execute (http_parser *parser,
 
       case s_req_query_string:
       {
-        if (normal_url_char[(unsigned char)ch]) break;
+        if (normal_url_char[(unsigned char)ch]) {
+          SKIP_PLAIN(url);
+          break;
+        }
 
         switch (ch) {
           case '?':
@@ -897,7 +1107,10 @@ size_t http_parser_execute (http_parser *parser,
 
       case s_req_fragment:
       {
-        if (normal_url_char[(unsigned char)ch]) break;
+        if (normal_url_char[(unsigned char)ch]) {
+          SKIP_PLAIN(url);
+          break;
+        }
 
         switch (ch) {
           case ' ':
@@ -1077,6 +1290,7 @@ size_t http_parser_execute (http_parser *parser,
         if (c) {
           switch (header_state) {
             case h_general:
+              SKIP_PLAIN(field);
               break;
 
             case h_C:
@@ -1279,6 +1493,7 @@ size_t http_parser_execute (http_parser *parser,
 
         switch (header_state) {
           case h_general:
+            SKIP_PLAIN(value);
             break;
 
           case h_connection:
@@ -1568,7 +1783,7 @@ size_t http_parser_execute (http_parser *parser,
   parser->state = state;
   parser->header_state = header_state;
   parser->index = (unsigned char)index;
-  parser->nread = (unsigned char)nread;
+  parser->nread = (uint32_t)nread;
 
   return len;
 
@@ -1608,6 +1823,8 @@ const char * http_method_str (enum http_method m)
 void
 http_parser_init (http_parser *parser, enum http_parser_type t)
 {
+  http_scanners_init();
+
   parser->type = t;
   parser->state = (t == HTTP_REQUEST ? s_start_req : (t == HTTP_RESPONSE ? s_start_res : s_start_req_or_res));
   parser->nread = 0;
@@ -0,0 +1,120 @@
+/*
+ * Negative cache - recently missing paths answered without open()
+ *
+ * A direct-mapped table of AWS_NEG_CACHE_SIZE slots: an insert simply
+ * replaces whatever entry hashed to the same slot, so the cache is bounded
+ * and never needs an eviction pass. Entries expire after
+ * AWS_NEG_CACHE_TTL seconds and are removed as soon as the file watcher
+ * sees the path created. Paths longer than AWS_NEG_CACHE_PATH_MAX are not
+ * cached.
+ *
+ * 2022, Operating Systems
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "aws.h"
+#include "neg_cache.h"
+#include "stats.h"
+
+struct neg_entry {
+	unsigned int hash;
+	unsigned int len;		/* 0 if the slot is empty */
+	time_t expires;
+	char path[AWS_NEG_CACHE_PATH_MAX];
+};
+
+static struct neg_entry table[AWS_NEG_CACHE_SIZE];
+
+/* bumped by every invalidation, see neg_cache_insert() */
+static unsigned int generation;
+
+static unsigned int path_hash(const char *path, size_t len)
+{
+	unsigned int h = 2166136261u;	/* FNV-1a */
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char)path[i];
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+static struct neg_entry *neg_find(const char *path, size_t len)
+{
+	unsigned int h = path_hash(path, len);
+	struct neg_entry *e = &table[h % AWS_NEG_CACHE_SIZE];
+
+	if (e->len != len || e->hash != h || memcmp(e->path, path, len) != 0)
+		return NULL;
+
+	return e;
+}
+
+/* Return 1 if path is known not to exist. */
+
+int neg_cache_lookup(const char *path, size_t len)
+{
+	struct neg_entry *e = neg_find(path, len);
+
+	if (e == NULL)
+		return 0;
+
+	if (e->expires <= time(NULL)) {
+		e->len = 0;
+		return 0;
+	}
+
+	aws_stats.neg_cache_hits++;
+
+	return 1;
+}
+
+/*
+ * Callers that look a path up off the event loop read the generation
+ * before the lookup and pass it to neg_cache_insert(). An invalidation in
+ * between (the file may have just been created) makes the insert a no-op.
+ */
+
+unsigned int neg_cache_generation(void)
+{
+	return generation;
+}
+
+void neg_cache_insert(const char *path, size_t len, unsigned int gen)
+{
+	unsigned int h;
+	struct neg_entry *e;
+
+	if (gen != generation || len == 0 || len > AWS_NEG_CACHE_PATH_MAX)
+		return;
+
+	h = path_hash(path, len);
+	e = &table[h % AWS_NEG_CACHE_SIZE];
+	e->hash = h;
+	e->len = len;
+	e->expires = time(NULL) + AWS_NEG_CACHE_TTL;
+	memcpy(e->path, path, len);
+}
+
+void neg_cache_remove(const char *path, size_t len)
+{
+	struct neg_entry *e = neg_find(path, len);
+
+	generation++;
+	if (e != NULL)
+		e->len = 0;
+}
+
+void neg_cache_flush(void)
+{
+	size_t i;
+
+	generation++;
+	for (i = 0; i < AWS_NEG_CACHE_SIZE; i++)
+		table[i].len = 0;
+	aws_stats.neg_cache_flushes++;
+}
@@ -0,0 +1,26 @@
+/*
+ * Negative cache - recently missing paths answered without open()
+ *
+ * 2022, Operating Systems
+ */
+
+#ifndef NEG_CACHE_H_
+#define NEG_CACHE_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+int neg_cache_lookup(const char *path, size_t len);
+unsigned int neg_cache_generation(void);
+void neg_cache_insert(const char *path, size_t len, unsigned int generation);
+void neg_cache_remove(const char *path, size_t len);
+void neg_cache_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NEG_CACHE_H_ */
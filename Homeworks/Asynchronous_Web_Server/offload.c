@@ -0,0 +1,329 @@
+/*
+ * Offload pool - blocking file syscalls run off the event loop
+ *
+ * A cold open() or stat() may wait on the disk for a long time, and on
+ * the event loop that stalls every connection. Such calls are handed to
+ * AWS_OFFLOAD_THREADS worker threads instead (other pools, such as the
+ * plugin handlers', work the same way):
+ *
+ *   - jobs go through a bounded lock-free MPMC ring (one sequence number
+ *     per slot) and a semaphore wakes an idle worker;
+ *   - finished jobs are pushed on a lock-free stack and an eventfd, kept
+ *     in the server's epoll set, tells the event loop to collect them.
+ *
+ * Done callbacks only ever run on the event loop thread, in
+ * offload_pool_complete().
+ *
+ * 2022, Operating Systems
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "util.h"
+#include "aws.h"
+#include "offload.h"
+#include "file_hints.h"
+#include "dir_cache.h"
+
+/*
+ * One pool: a ring of queue slots (a power of two), the workers' wakeup
+ * semaphore and the completion stack with its eventfd.
+ */
+struct ring_slot {
+	atomic_size_t seq;
+	struct offload_job *job;
+};
+
+struct offload_pool {
+	struct ring_slot *ring;
+	size_t mask;
+	atomic_size_t enqueue_pos;
+	atomic_size_t dequeue_pos;
+	sem_t ring_items;
+	struct offload_job *_Atomic done_stack;
+	int done_fd;
+	int threads;
+};
+
+/* the pool for file syscalls, behind offload_init() and friends */
+static struct offload_pool *file_pool;
+
+static int ring_push(struct offload_pool *pool, struct offload_job *job)
+{
+	size_t pos = atomic_load_explicit(&pool->enqueue_pos,
+			memory_order_relaxed);
+	struct ring_slot *slot;
+
+	for (;;) {
+		slot = &pool->ring[pos & pool->mask];
+		size_t seq = atomic_load_explicit(&slot->seq,
+				memory_order_acquire);
+		intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(
+					&pool->enqueue_pos, &pos, pos + 1,
+					memory_order_relaxed,
+					memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			return -1;	/* full */
+		} else {
+			pos = atomic_load_explicit(&pool->enqueue_pos,
+					memory_order_relaxed);
+		}
+	}
+
+	slot->job = job;
+	atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+	return 0;
+}
+
+static struct offload_job *ring_pop(struct offload_pool *pool)
+{
+	size_t pos = atomic_load_explicit(&pool->dequeue_pos,
+			memory_order_relaxed);
+	struct ring_slot *slot;
+	struct offload_job *job;
+
+	for (;;) {
+		slot = &pool->ring[pos & pool->mask];
+		size_t seq = atomic_load_explicit(&slot->seq,
+				memory_order_acquire);
+		intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(
+					&pool->dequeue_pos, &pos, pos + 1,
+					memory_order_relaxed,
+					memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			return NULL;	/* empty */
+		} else {
+			pos = atomic_load_explicit(&pool->dequeue_pos,
+					memory_order_relaxed);
+		}
+	}
+
+	job = slot->job;
+	atomic_store_explicit(&slot->seq, pos + pool->mask + 1,
+			memory_order_release);
+
+	return job;
+}
+
+/* Do the blocking part of a job; any thread may call this. */
+
+void offload_run(struct offload_job *job)
+{
+	job->err = 0;
+
+	switch (job->op) {
+	case OFFLOAD_OPEN:
+		job->cached = -1;
+		job->fd = dir_openat(job->dirfd, job->path, strlen(job->path),
+				O_RDONLY | O_CLOEXEC);
+		if (job->fd < 0 || fstat(job->fd, &job->st) < 0) {
+			job->err = errno;
+			break;
+		}
+		if (job->hints) {
+			job->cached = file_hints_probe(job->fd, job->st.st_size);
+			file_hints_open(job->fd, job->st.st_size);
+		}
+		break;
+	case OFFLOAD_STAT:
+		if (stat(job->path, &job->st) < 0)
+			job->err = errno;
+		break;
+	case OFFLOAD_FADVISE:
+		job->err = posix_fadvise(job->fd, job->off, job->len,
+				job->advice);
+		break;
+	case OFFLOAD_CALL:
+		job->call(job);
+		break;
+	}
+}
+
+/*
+ * Push a finished job on the pool's completion stack and kick the event
+ * loop. Safe from any thread; a job must not be posted again before its
+ * done callback has started.
+ */
+
+void offload_pool_post(struct offload_pool *pool, struct offload_job *job)
+{
+	uint64_t one = 1;
+
+	job->next = atomic_load_explicit(&pool->done_stack,
+			memory_order_relaxed);
+	while (!atomic_compare_exchange_weak_explicit(&pool->done_stack,
+			&job->next, job, memory_order_release,
+			memory_order_relaxed))
+		;
+
+	/* the counter only has to be non-zero; EAGAIN means it is */
+	if (write(pool->done_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		ERR("offload: eventfd write");
+}
+
+static void *offload_worker(void *arg)
+{
+	struct offload_pool *pool = arg;
+	struct offload_job *job;
+
+	for (;;) {
+		while (sem_wait(&pool->ring_items) < 0)
+			;
+
+		/* a producer may still be publishing the slot we were woken for */
+		while ((job = ring_pop(pool)) == NULL)
+			sched_yield();
+
+		offload_run(job);
+		offload_pool_post(pool, job);
+	}
+
+	return NULL;
+}
+
+/*
+ * Create a pool of threads workers queueing at most queue jobs (a power
+ * of two, at least 2: with a single slot, the sequence a push leaves is
+ * the one the next push expects, and it would overwrite the queued job).
+ * Returns NULL on failure.
+ */
+
+struct offload_pool *offload_pool_create(int threads, size_t queue)
+{
+	struct offload_pool *pool;
+	pthread_t tid;
+	size_t i;
+	int n;
+
+	if (queue < 2 || (queue & (queue - 1)) != 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pool = calloc(1, sizeof(*pool));
+	if (pool == NULL)
+		return NULL;
+
+	pool->ring = calloc(queue, sizeof(*pool->ring));
+	if (pool->ring == NULL)
+		return NULL;
+	pool->mask = queue - 1;
+	pool->threads = threads;
+
+	for (i = 0; i < queue; i++)
+		atomic_init(&pool->ring[i].seq, i);
+
+	if (sem_init(&pool->ring_items, 0, 0) < 0)
+		return NULL;
+
+	pool->done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (pool->done_fd < 0)
+		return NULL;
+
+	for (n = 0; n < threads; n++) {
+		if (pthread_create(&tid, NULL, offload_worker, pool) != 0)
+			return NULL;
+		pthread_detach(tid);
+	}
+
+	return pool;
+}
+
+/* The eventfd to watch for EPOLLIN; call offload_pool_complete() then. */
+
+int offload_pool_fd(struct offload_pool *pool)
+{
+	return pool->done_fd;
+}
+
+/*
+ * Queue job for a worker. Returns -1 when there are no workers or the
+ * queue is full.
+ */
+
+int offload_pool_submit(struct offload_pool *pool, struct offload_job *job)
+{
+	if (pool->threads == 0 || ring_push(pool, job) < 0)
+		return -1;
+
+	sem_post(&pool->ring_items);
+
+	return 0;
+}
+
+/* Run the done callbacks of all finished jobs, in completion order. */
+
+void offload_pool_complete(struct offload_pool *pool)
+{
+	struct offload_job *list, *job, *fifo = NULL;
+	uint64_t count;
+
+	if (read(pool->done_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		return;
+
+	list = atomic_exchange_explicit(&pool->done_stack, NULL,
+			memory_order_acquire);
+
+	/* the stack holds the newest job first */
+	while (list != NULL) {
+		job = list;
+		list = list->next;
+		job->next = fifo;
+		fifo = job;
+	}
+
+	while (fifo != NULL) {
+		job = fifo;
+		fifo = fifo->next;
+		job->done(job);
+	}
+}
+
+/*
+ * Start the file syscall workers. Returns the eventfd to watch for EPOLLIN
+ * (call offload_complete() then), or -1 on failure.
+ */
+
+int offload_init(void)
+{
+	file_pool = offload_pool_create(AWS_OFFLOAD_THREADS, AWS_OFFLOAD_QUEUE);
+	if (file_pool == NULL)
+		return -1;
+
+	return file_pool->done_fd;
+}
+
+/*
+ * Queue a file syscall job. Returns -1 when there are no workers or the
+ * queue is full; the caller may then run the job itself (offload_run).
+ */
+
+int offload_submit(struct offload_job *job)
+{
+	return offload_pool_submit(file_pool, job);
+}
+
+void offload_complete(void)
+{
+	offload_pool_complete(file_pool);
+}
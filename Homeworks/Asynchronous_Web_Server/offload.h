@@ -0,0 +1,62 @@
+/*
+ * Offload pool - blocking file syscalls run off the event loop
+ *
+ * 2022, Operating Systems
+ */
+
+#ifndef OFFLOAD_H_
+#define OFFLOAD_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+enum offload_op {
+	OFFLOAD_OPEN,		/* open path beneath dirfd, fstat() and hints */
+	OFFLOAD_STAT,		/* stat(path) */
+	OFFLOAD_FADVISE,	/* posix_fadvise(fd, off, len, advice) */
+	OFFLOAD_CALL		/* call(job) */
+};
+
+/*
+ * A job is owned by the caller (usually embedded in a connection) and
+ * must stay alive until its done callback has run on the event loop.
+ */
+struct offload_job {
+	enum offload_op op;
+	const char *path;
+	int dirfd;		/* OPEN: directory handle path is relative to */
+	int fd;			/* OPEN: result, -1 on error; FADVISE: input */
+	int advice;
+	off_t off;
+	off_t len;
+	struct stat st;		/* OPEN, STAT */
+	int hints;		/* OPEN: probe the page cache and apply hints */
+	int cached;		/* OPEN: result of file_hints_probe() */
+	int err;		/* errno of the failed call, 0 on success */
+	void (*call)(struct offload_job *job);
+	void (*done)(struct offload_job *job);
+	struct offload_job *next;
+};
+
+struct offload_pool;
+
+struct offload_pool *offload_pool_create(int threads, size_t queue);
+int offload_pool_fd(struct offload_pool *pool);
+int offload_pool_submit(struct offload_pool *pool, struct offload_job *job);
+void offload_pool_post(struct offload_pool *pool, struct offload_job *job);
+void offload_pool_complete(struct offload_pool *pool);
+
+int offload_init(void);
+int offload_submit(struct offload_job *job);
+void offload_run(struct offload_job *job);
+void offload_complete(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OFFLOAD_H_ */
@@ -0,0 +1,145 @@
+/*
+ * Packed archive - many small static files served from one file
+ *
+ * The archive built by aws_pack is opened and mapped once at startup.
+ * Lookups only read the mapped index, so a hit costs no open() and no
+ * path walk; the data is sent with sendfile() from the archive's single
+ * descriptor, at the entry's offset. The archive is read-only: a new one
+ * is put in place with rename() and picked up on restart.
+ *
+ * 2022, Operating Systems
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "debug.h"
+#include "pack.h"
+
+static int fd = -1;
+static const char *base;
+static const struct pack_header *header;
+static const uint32_t *slots;
+static const struct pack_entry *entries;
+
+/*
+ * Check that the index only points inside the archive, and that it has an
+ * empty slot for lookups that miss to stop at.
+ */
+
+static int pack_validate(size_t size)
+{
+	const struct pack_entry *e;
+	size_t tables;
+	uint32_t i, empty = 0;
+
+	if (size < sizeof(*header) ||
+			memcmp(header->magic, PACK_MAGIC, 8) != 0 ||
+			header->version != PACK_VERSION ||
+			header->size != size)
+		return -1;
+
+	if (header->num_slots == 0 ||
+			(header->num_slots & (header->num_slots - 1)) != 0 ||
+			header->num_entries >= header->num_slots)
+		return -1;
+
+	tables = sizeof(*header) +
+		(size_t)header->num_slots * sizeof(*slots) +
+		(size_t)header->num_entries * sizeof(*entries);
+	if (tables > size)
+		return -1;
+
+	for (i = 0; i < header->num_slots; i++) {
+		if (slots[i] > header->num_entries)
+			return -1;
+		if (slots[i] == 0)
+			empty++;
+	}
+	if (empty == 0)
+		return -1;
+
+	for (i = 0; i < header->num_entries; i++) {
+		e = &entries[i];
+		if (e->path_off > size || e->path_len > size - e->path_off ||
+				e->off > size || e->size > size - e->off ||
+				e->gz_off > size || e->gz_size > size - e->gz_off)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Map the archive at path. Returns 0, or -1 if it is missing or invalid;
+ * lookups then simply miss.
+ */
+
+int pack_open(const char *path)
+{
+	struct stat st;
+	void *addr;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(*header))
+		goto fail;
+
+	addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED)
+		goto fail;
+
+	base = addr;
+	header = addr;
+	slots = (const uint32_t *)(base + sizeof(*header));
+	entries = (const struct pack_entry *)(slots + header->num_slots);
+
+	if (pack_validate(st.st_size) < 0) {
+		dlog(LOG_ERR, "%s: not a valid archive\n", path);
+		munmap(addr, st.st_size);
+		header = NULL;
+		goto fail;
+	}
+
+	/* the index is read on every lookup, the data only by sendfile() */
+	madvise(addr, (const char *)(entries + header->num_entries) - base,
+			MADV_WILLNEED);
+
+	return 0;
+
+fail:
+	close(fd);
+	fd = -1;
+	return -1;
+}
+
+int pack_fd(void)
+{
+	return fd;
+}
+
+const struct pack_entry *pack_lookup(const char *path, size_t len)
+{
+	uint32_t hash, mask, i, slot;
+	const struct pack_entry *e;
+
+	if (header == NULL)
+		return NULL;
+
+	hash = pack_hash(path, len);
+	mask = header->num_slots - 1;
+
+	for (i = hash & mask; (slot = slots[i]) != 0; i = (i + 1) & mask) {
+		e = &entries[slot - 1];
+		if (e->hash == hash && e->path_len == len &&
+				memcmp(base + e->path_off, path, len) == 0)
+			return e;
+	}
+
+	return NULL;
+}
@@ -0,0 +1,26 @@
+/*
+ * Packed archive - many small static files served from one file
+ *
+ * 2022, Operating Systems
+ */
+
+#ifndef PACK_H_
+#define PACK_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#include "pack_format.h"
+
+int pack_open(const char *path);
+int pack_fd(void);
+const struct pack_entry *pack_lookup(const char *path, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PACK_H_ */
@@ -0,0 +1,72 @@
+/*
+ * Packed archive - on-disk format shared by aws_pack and the server
+ *
+ * 2022, Operating Systems
+ */
+
+#ifndef PACK_FORMAT_H_
+#define PACK_FORMAT_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Layout, all integers in host byte order (the archive is built on the
+ * machine that serves it):
+ *
+ *   struct pack_header
+ *   uint32_t slots[num_slots]		entry index + 1, 0 if empty
+ *   struct pack_entry entries[num_entries]
+ *   paths				not NUL-terminated
+ *   file data				each file at a PACK_DATA_ALIGN offset
+ *
+ * slots is an open-addressing table (linear probing) keyed by the
+ * pack_hash() of the path; num_slots is a power of two.
+ */
+
+#define PACK_MAGIC		"AWSPACK1"
+#define PACK_VERSION		1
+#define PACK_DATA_ALIGN		64	/* a power of two */
+
+struct pack_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t num_entries;
+	uint32_t num_slots;
+	uint32_t reserved;
+	uint64_t size;			/* whole archive, for validation */
+};
+
+struct pack_entry {
+	uint64_t path_off;
+	uint32_t path_len;
+	uint32_t hash;
+	uint64_t off;			/* file data */
+	uint64_t size;
+	uint64_t gz_off;		/* precompressed variant */
+	uint64_t gz_size;		/* 0 if there is none */
+	uint64_t etag;			/* FNV-1a of the data */
+};
+
+static inline uint32_t pack_hash(const char *path, size_t len)
+{
+	uint32_t h = 2166136261u;	/* FNV-1a */
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char)path[i];
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PACK_FORMAT_H_ */
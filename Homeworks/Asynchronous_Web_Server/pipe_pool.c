@@ -0,0 +1,66 @@
+/*
+ * Pipe pool - reusable pipes for the splice() engine
+ *
+ * Creating a pipe costs two file descriptors and a couple of syscalls, so
+ * pipes are handed back here when a transfer is done and reused by the
+ * next spliced response. Only empty pipes are kept.
+ *
+ * 2022, Operating Systems
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "aws.h"
+#include "pipe_pool.h"
+
+static int pool[AWS_PIPE_POOL_SIZE][2];
+static int pool_len;
+
+/*
+ * Fill p with a non-blocking pipe, reused from the pool if possible.
+ * Returns 0 on success, -1 (with errno set) on failure.
+ */
+
+int pipe_pool_get(struct pipe_pair *p)
+{
+	p->pending = 0;
+
+	if (pool_len > 0) {
+		pool_len--;
+		p->fds[0] = pool[pool_len][0];
+		p->fds[1] = pool[pool_len][1];
+		return 0;
+	}
+
+	if (pipe2(p->fds, O_NONBLOCK | O_CLOEXEC) < 0) {
+		p->fds[0] = p->fds[1] = -1;
+		return -1;
+	}
+
+	/* best effort: a bigger pipe means fewer splice() round trips */
+	fcntl(p->fds[0], F_SETPIPE_SZ, AWS_PIPE_SZ);
+
+	return 0;
+}
+
+/* Give p back; a pipe with data left in it cannot be reused and is closed. */
+
+void pipe_pool_put(struct pipe_pair *p)
+{
+	if (p->fds[0] < 0)
+		return;
+
+	if (p->pending == 0 && pool_len < AWS_PIPE_POOL_SIZE) {
+		pool[pool_len][0] = p->fds[0];
+		pool[pool_len][1] = p->fds[1];
+		pool_len++;
+	} else {
+		close(p->fds[0]);
+		close(p->fds[1]);
+	}
+
+	p->fds[0] = p->fds[1] = -1;
+	p->pending = 0;
+}
@@ -0,0 +1,29 @@
+/*
+ * Pipe pool - reusable pipes for the splice() engine
+ *
+ * 2022, Operating Systems
+ */
+
+#ifndef PIPE_POOL_H_
+#define PIPE_POOL_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/* a pipe lent to a connection; pending counts bytes still inside it */
+struct pipe_pair {
+	int fds[2];
+	size_t pending;
+};
+
+int pipe_pool_get(struct pipe_pair *p);
+void pipe_pool_put(struct pipe_pair *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PIPE_POOL_H_ */
@@ -0,0 +1,396 @@
+/*
+ * Plugins - handlers from shared objects, run on a worker pool
+ *
+ * Plugins are loaded with dlopen() at startup, before the event loop
+ * runs, and looked up by the shared object path their route names. A
+ * request on a plugin route becomes a plugin_call that runs the handler
+ * on a pool of AWS_PLUGIN_THREADS workers of its own (see offload.c), so
+ * a slow handler never holds up file opens, and the event loop never
+ * runs plugin code.
+ *
+ * Body data travels back as chunks. The worker pushes each chunk on the
+ * call's lock-free list and, unless a notification is already pending,
+ * posts the call's notify job to the pool's completion queue. On the
+ * event loop the chunks are fed to the connection's stream. A call may
+ * have at most AWS_PLUGIN_WINDOW chunks in flight: past that the worker
+ * waits until the client has taken some.
+ *
+ * 2022, Operating Systems
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "aws.h"
+#include "debug.h"
+#include "aws_plugin.h"
+#include "plugin.h"
+#include "offload.h"
+#include "stats.h"
+
+struct plugin {
+	const char *so_path;
+	const struct aws_plugin *ops;
+};
+
+struct reply_chunk {
+	struct reply_chunk *next;
+	size_t len;
+	char data[];
+};
+
+/*
+ * The handle a handler sees as its reply. Owned by the worker while the
+ * handler runs, then by the stream; whichever lets go last frees it.
+ */
+struct aws_reply {
+	struct plugin *plugin;
+	struct aws_request req;
+	struct offload_job job;		/* runs the handler */
+	struct offload_job notify;	/* "chunks are waiting" */
+	atomic_int notified;
+	atomic_int cancelled;		/* client gone, stop writing */
+	struct reply_chunk *_Atomic pushed;	/* newest first */
+	sem_t window;			/* chunks the worker may still push */
+
+	/* event loop side */
+	struct reply_chunk *pending;	/* oldest first */
+	struct reply_chunk *pending_tail;
+	size_t pending_off;
+	struct stream *stream;		/* NULL once the connection is gone */
+	plugin_ready_fn ready;
+	int started;			/* ready() was called */
+	int finished;			/* the handler returned */
+	int status;
+	uint64_t latency_us;
+	char uri[];
+};
+
+static struct plugin plugins[AWS_PLUGIN_MAX];
+static int num_plugins;
+
+static struct offload_pool *pool;
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Start the handler workers. Returns their eventfd, or -1. */
+
+int plugin_init(void)
+{
+	pool = offload_pool_create(AWS_PLUGIN_THREADS, AWS_PLUGIN_QUEUE);
+	if (pool == NULL)
+		return -1;
+
+	return offload_pool_fd(pool);
+}
+
+/* Load the plugin in so_path. Returns 0, or -1 if it cannot be used. */
+
+int plugin_load(const char *so_path)
+{
+	const struct aws_plugin *ops;
+	void *dl;
+
+	if (num_plugins == AWS_PLUGIN_MAX)
+		return -1;
+
+	dl = dlopen(so_path, RTLD_NOW | RTLD_LOCAL);
+	if (dl == NULL) {
+		dlog(LOG_ERR, "Cannot load %s: %s\n", so_path, dlerror());
+		return -1;
+	}
+
+	ops = dlsym(dl, "aws_plugin");
+	if (ops == NULL || ops->abi != AWS_PLUGIN_ABI || ops->handle == NULL) {
+		dlog(LOG_ERR, "%s is not an aws plugin\n", so_path);
+		dlclose(dl);
+		return -1;
+	}
+
+	plugins[num_plugins].so_path = so_path;
+	plugins[num_plugins].ops = ops;
+	num_plugins++;
+	dlog(LOG_INFO, "Loaded plugin %s from %s\n", ops->name, so_path);
+
+	return 0;
+}
+
+struct plugin *plugin_find(const char *so_path)
+{
+	int i;
+
+	for (i = 0; i < num_plugins; i++)
+		if (strcmp(plugins[i].so_path, so_path) == 0)
+			return &plugins[i];
+
+	return NULL;
+}
+
+static void reply_free(struct aws_reply *r)
+{
+	struct reply_chunk *c;
+
+	while ((c = r->pending) != NULL) {
+		r->pending = c->next;
+		free(c);
+	}
+	sem_destroy(&r->window);
+	free(r);
+}
+
+/* Worker side: the handler hands over some body. */
+
+int aws_reply_write(struct aws_reply *r, const void *data, size_t len)
+{
+	struct reply_chunk *c;
+
+	if (atomic_load_explicit(&r->cancelled, memory_order_acquire))
+		return -1;
+	if (len == 0)
+		return 0;
+
+	while (sem_wait(&r->window) < 0)
+		;
+	if (atomic_load_explicit(&r->cancelled, memory_order_acquire)) {
+		sem_post(&r->window);	/* let the next write through too */
+		return -1;
+	}
+
+	c = malloc(sizeof(*c) + len);
+	if (c == NULL) {
+		sem_post(&r->window);
+		return -1;
+	}
+	c->len = len;
+	memcpy(c->data, data, len);
+
+	c->next = atomic_load_explicit(&r->pushed, memory_order_relaxed);
+	while (!atomic_compare_exchange_weak_explicit(&r->pushed, &c->next, c,
+			memory_order_release, memory_order_relaxed))
+		;
+
+	if (!atomic_exchange_explicit(&r->notified, 1, memory_order_acq_rel))
+		offload_pool_post(pool, &r->notify);
+
+	return 0;
+}
+
+static void plugin_run(struct offload_job *job)
+{
+	struct aws_reply *r = (struct aws_reply *)
+		((char *)job - offsetof(struct aws_reply, job));
+	uint64_t start = now_us();
+
+	r->status = r->plugin->ops->handle(&r->req, r);
+	r->latency_us = now_us() - start;
+}
+
+/* Move what the worker pushed to the end of the pending list. */
+
+static void reply_collect(struct aws_reply *r)
+{
+	struct reply_chunk *list, *c, *fifo = NULL, *last;
+
+	list = atomic_exchange_explicit(&r->pushed, NULL,
+			memory_order_acquire);
+	if (list == NULL)
+		return;
+
+	last = list;
+	while (list != NULL) {
+		c = list;
+		list = list->next;
+		c->next = fifo;
+		fifo = c;
+	}
+
+	if (r->pending_tail != NULL)
+		r->pending_tail->next = fifo;
+	else
+		r->pending = fifo;
+	r->pending_tail = last;
+}
+
+/* Let the connection know there is something to send. */
+
+static void reply_kick(struct aws_reply *r)
+{
+	if (r->started) {
+		stream_wake(r->stream);
+		return;
+	}
+
+	if (r->pending == NULL && !r->finished)
+		return;
+
+	r->started = 1;
+	r->ready(r->stream, r->pending == NULL && r->status != 0 ? -1 : 0);
+}
+
+static void plugin_notified(struct offload_job *job)
+{
+	struct aws_reply *r = (struct aws_reply *)
+		((char *)job - offsetof(struct aws_reply, notify));
+
+	atomic_store_explicit(&r->notified, 0, memory_order_release);
+	if (r->stream == NULL)
+		return;
+
+	reply_collect(r);
+	reply_kick(r);
+}
+
+static void plugin_done(struct offload_job *job)
+{
+	struct aws_reply *r = (struct aws_reply *)
+		((char *)job - offsetof(struct aws_reply, job));
+
+	aws_stats.plugin_queue_depth--;
+	aws_stats.plugin_latency_us += r->latency_us;
+	if (r->latency_us > aws_stats.plugin_latency_max_us)
+		aws_stats.plugin_latency_max_us = r->latency_us;
+	if (r->status != 0)
+		aws_stats.plugin_failures++;
+
+	r->finished = 1;
+	reply_collect(r);
+
+	if (r->stream == NULL) {
+		reply_free(r);
+		return;
+	}
+
+	reply_kick(r);
+}
+
+/* Stream producer: feed the pending chunks, end after the last one. */
+
+static void plugin_produce(struct stream *s)
+{
+	struct aws_reply *r = s->priv;
+	struct reply_chunk *c;
+	size_t n;
+
+	while ((c = r->pending) != NULL) {
+		n = stream_write(s, c->data + r->pending_off,
+				c->len - r->pending_off);
+		if (n == 0)
+			return;
+		r->pending_off += n;
+		if (r->pending_off < c->len)
+			return;
+
+		r->pending = c->next;
+		if (r->pending == NULL)
+			r->pending_tail = NULL;
+		r->pending_off = 0;
+		free(c);
+		sem_post(&r->window);
+	}
+
+	/* a handler that failed midway must not look like it finished */
+	if (r->finished && r->status != 0)
+		stream_abort(s);
+	else if (r->finished)
+		stream_end(s);
+}
+
+/*
+ * The connection is done with the stream. A handler still running is told
+ * to stop and let go of the reply when it returns.
+ */
+
+static void plugin_close(struct stream *s)
+{
+	struct aws_reply *r = s->priv;
+	int i;
+
+	r->stream = NULL;
+	if (r->finished) {
+		reply_free(r);
+		return;
+	}
+
+	atomic_store_explicit(&r->cancelled, 1, memory_order_release);
+	for (i = 0; i < AWS_PLUGIN_WINDOW; i++)
+		sem_post(&r->window);
+}
+
+static const struct stream_ops plugin_stream_ops = {
+	.produce = plugin_produce,
+	.close = plugin_close,
+};
+
+/*
+ * Run the plugin p for the request uri (prefix_len bytes of it matched the
+ * route) and stream its output on s. ready() is called once the response
+ * can start. Returns 0, or -1 if the handler cannot be queued now.
+ */
+
+int plugin_call(struct plugin *p, struct stream *s, const char *uri,
+		size_t uri_len, size_t prefix_len, int http_minor,
+		int chunked, plugin_ready_fn ready)
+{
+	struct aws_reply *r;
+
+	r = calloc(1, sizeof(*r) + uri_len + 1);
+	if (r == NULL)
+		return -1;
+
+	memcpy(r->uri, uri, uri_len);
+	r->uri[uri_len] = '\0';
+	r->plugin = p;
+	r->req.uri = r->uri;
+	r->req.uri_len = uri_len;
+	r->req.path = r->uri + prefix_len;
+	r->req.path_len = uri_len - prefix_len;
+	r->req.http_minor = http_minor;
+	r->stream = s;
+	r->ready = ready;
+	sem_init(&r->window, 0, AWS_PLUGIN_WINDOW);
+
+	r->job.op = OFFLOAD_CALL;
+	r->job.call = plugin_run;
+	r->job.done = plugin_done;
+	r->notify.done = plugin_notified;
+
+	if (stream_open(s, &plugin_stream_ops, r, chunked) < 0) {
+		reply_free(r);
+		return -1;
+	}
+
+	if (offload_pool_submit(pool, &r->job) < 0) {
+		aws_stats.plugin_rejected++;
+		r->finished = 1;	/* so that closing the stream frees r */
+		stream_close(s);
+		return -1;
+	}
+
+	aws_stats.plugin_calls++;
+	aws_stats.plugin_queue_depth++;
+	if (aws_stats.plugin_queue_depth > aws_stats.plugin_queue_depth_max)
+		aws_stats.plugin_queue_depth_max = aws_stats.plugin_queue_depth;
+
+	return 0;
+}
+
+/* Event loop: the plugin pool's eventfd is readable. */
+
+void plugin_complete(void)
+{
+	offload_pool_complete(pool);
+}
@@ -0,0 +1,38 @@
+/*
+ * Plugins - handlers from shared objects, run on a worker pool
+ *
+ * 2022, Operating Systems
+ */
+
+#ifndef PLUGIN_H_
+#define PLUGIN_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#include "stream.h"
+
+struct plugin;
+
+/*
+ * Called on the event loop once the handler has produced its first bytes
+ * (status 0) or failed before writing anything (status -1).
+ */
+typedef void (*plugin_ready_fn)(struct stream *s, int status);
+
+int plugin_init(void);
+int plugin_load(const char *so_path);
+struct plugin *plugin_find(const char *so_path);
+int plugin_call(struct plugin *p, struct stream *s, const char *uri,
+		size_t uri_len, size_t prefix_len, int http_minor,
+		int chunked, plugin_ready_fn ready);
+void plugin_complete(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PLUGIN_H_ */
@@ -0,0 +1,47 @@
+/*
+ * hello - sample handler plugin
+ *
+ * /app/<anything> answers with a greeting naming the request;
+ * /app/count/<n> streams the numbers 1 to n, one write each.
+ *
+ * 2022, Operating Systems
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "aws_plugin.h"
+
+static int hello_handle(const struct aws_request *req, struct aws_reply *reply)
+{
+	char line[64];
+	int n, i, len;
+
+	if (req->path_len > 6 && strncmp(req->path, "count/", 6) == 0) {
+		n = atoi(req->path + 6);
+		for (i = 1; i <= n; i++) {
+			len = snprintf(line, sizeof(line), "%d\n", i);
+			if (aws_reply_write(reply, line, len) < 0)
+				return -1;
+			usleep(1000);
+		}
+		return 0;
+	}
+
+	if (req->path_len == 4 && memcmp(req->path, "fail", 4) == 0)
+		return -1;
+
+	aws_reply_write(reply, "Hello from ", 11);
+	aws_reply_write(reply, req->uri, req->uri_len);
+	aws_reply_write(reply, "\n", 1);
+
+	return 0;
+}
+
+const struct aws_plugin aws_plugin = {
+	.abi = AWS_PLUGIN_ABI,
+	.name = "hello",
+	.handle = hello_handle,
+};
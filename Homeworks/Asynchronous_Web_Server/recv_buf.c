@@ -0,0 +1,106 @@
+/*
+ * Receive buffer - request bytes accumulated across recv() calls
+ *
+ * Buffers come from slabs of doubling sizes, starting at AWS_RECV_BUF_MIN
+ * and capped at HTTP_MAX_HEADER_SIZE. A request starts in the smallest
+ * one and moves to the next size only when it fills it, so ordinary
+ * requests never use more than one small buffer, and a buffer goes back
+ * to its slab as soon as the request is done with it.
+ *
+ * 2022, Operating Systems
+ */
+
+#include <string.h>
+
+#include "aws.h"
+#include "http_parser.h"
+#include "slab.h"
+#include "recv_buf.h"
+
+#define RECV_BUF_CLASSES	16
+
+static struct slab pools[RECV_BUF_CLASSES];
+static size_t class_size[RECV_BUF_CLASSES];
+static int num_classes;
+
+static void recv_buf_pools_init(void)
+{
+	size_t size = AWS_RECV_BUF_MIN;
+
+	while (num_classes < RECV_BUF_CLASSES) {
+		if (size >= HTTP_MAX_HEADER_SIZE)
+			size = HTTP_MAX_HEADER_SIZE;
+
+		class_size[num_classes] = size;
+		/* about AWS_RECV_BUF_CHUNK bytes per slab refill */
+		slab_init(&pools[num_classes], size,
+				AWS_RECV_BUF_CHUNK / size);
+		num_classes++;
+
+		if (size == HTTP_MAX_HEADER_SIZE)
+			break;
+		size *= 2;
+	}
+}
+
+void recv_buf_init(struct recv_buf *b)
+{
+	b->data = NULL;
+	b->len = 0;
+	b->size = 0;
+	b->size_class = -1;
+}
+
+/*
+ * Move the contents to a buffer of the next size. Returns 0 on success, -1
+ * if the buffer is already HTTP_MAX_HEADER_SIZE long or memory ran out; the
+ * old contents are kept in both cases.
+ */
+
+int recv_buf_grow(struct recv_buf *b)
+{
+	int next = b->size_class + 1;
+	char *data;
+
+	if (num_classes == 0)
+		recv_buf_pools_init();
+
+	if (next >= num_classes)
+		return -1;
+
+	data = slab_alloc(&pools[next]);
+	if (data == NULL)
+		return -1;
+
+	if (b->len > 0)
+		memcpy(data, b->data, b->len);
+	if (b->data != NULL)
+		slab_free(&pools[b->size_class], b->data);
+
+	b->data = data;
+	b->size = class_size[next];
+	b->size_class = next;
+
+	return 0;
+}
+
+void recv_buf_release(struct recv_buf *b)
+{
+	if (b->data != NULL)
+		slab_free(&pools[b->size_class], b->data);
+
+	recv_buf_init(b);
+}
+
+/* Bytes of receive buffers handed out. */
+
+size_t recv_buf_bytes(void)
+{
+	size_t bytes = 0;
+	int i;
+
+	for (i = 0; i < num_classes; i++)
+		bytes += pools[i].in_use * class_size[i];
+
+	return bytes;
+}
@@ -0,0 +1,36 @@
+/*
+ * Receive buffer - request bytes accumulated across recv() calls
+ *
+ * 2022, Operating Systems
+ */
+
+#ifndef RECV_BUF_H_
+#define RECV_BUF_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/*
+ * The buffer is contiguous so the parser's slices (offsets from data) stay
+ * valid when it grows; only data itself moves.
+ */
+struct recv_buf {
+	char *data;
+	size_t len;
+	size_t size;
+	int size_class;		/* index of the pool data came from, -1 if none */
+};
+
+void recv_buf_init(struct recv_buf *b);
+int recv_buf_grow(struct recv_buf *b);
+void recv_buf_release(struct recv_buf *b);
+size_t recv_buf_bytes(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RECV_BUF_H_ */
@@ -0,0 +1,263 @@
+/*
+ * Response headers - preformatted templates filled in place
+ *
+ * A response header is put together from a few pieces copied straight
+ * into the connection's send buffer. The status line and the Date header
+ * come as one template per status line; the date in them is rewritten by
+ * resp_header_tick(), which the event loop calls once per iteration and
+ * which only does work when the second changes. Numbers are formatted by
+ * hand, two digits at a time, instead of going through printf.
+ *
+ * 2022, Operating Systems
+ */
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <time.h>
+
+#include "resp_header.h"
+
+/* "Sun, 06 Nov 1994 08:49:37 GMT" */
+#define DATE_LEN	29
+
+struct status_template {
+	char text[96];
+	size_t len;
+	size_t date_off;	/* where the date starts in text */
+};
+
+struct line {
+	const char *text;
+	size_t len;
+};
+
+#define LINE(s)		{ s, sizeof(s) - 1 }
+
+static const struct line status_lines[RESP_STATUS_COUNT] = {
+	[RESP_200_OK]		= LINE("HTTP/1.0 200 OK\r\n"),
+	[RESP_200_OK_HTTP11]	= LINE("HTTP/1.1 200 OK\r\n"),
+	[RESP_304_NOT_MODIFIED]	= LINE("HTTP/1.0 304 Not Modified\r\n"),
+	[RESP_404_NOT_FOUND]	= LINE("HTTP/1.0 404 Not Found\r\n"),
+	[RESP_429_TOO_MANY_REQUESTS] =
+		LINE("HTTP/1.0 429 Too Many Requests\r\n"),
+	[RESP_500_INTERNAL_ERROR] =
+		LINE("HTTP/1.0 500 Internal Server Error\r\n"),
+	[RESP_503_UNAVAILABLE]	= LINE("HTTP/1.0 503 Service Unavailable\r\n"),
+};
+
+static const struct line type_lines[RESP_TYPE_COUNT] = {
+	[RESP_TYPE_OCTET_STREAM] =
+		LINE("Content-Type: application/octet-stream\r\n"),
+	[RESP_TYPE_TEXT_PLAIN]	= LINE("Content-Type: text/plain\r\n"),
+};
+
+static struct status_template templates[RESP_STATUS_COUNT];
+
+/* the whole 404 and 429 responses, sent as is */
+static char not_found[128];
+static size_t not_found_len;
+static char too_many[160];
+static size_t too_many_len;
+
+static time_t date_sec = -1;
+
+static const char digits2[] =
+	"0001020304050607080910111213141516171819"
+	"2021222324252627282930313233343536373839"
+	"4041424344454647484950515253545556575859"
+	"6061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+static const char wdays[] = "SunMonTueWedThuFriSat";
+static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+static char *put2(char *p, unsigned int v)
+{
+	p[0] = digits2[2 * v];
+	p[1] = digits2[2 * v + 1];
+
+	return p + 2;
+}
+
+static void format_date(char *p, const struct tm *tm)
+{
+	memcpy(p, wdays + 3 * tm->tm_wday, 3);
+	p[3] = ',';
+	p[4] = ' ';
+	p = put2(p + 5, tm->tm_mday);
+	*p++ = ' ';
+	memcpy(p, months + 3 * tm->tm_mon, 3);
+	p[3] = ' ';
+	p = put2(p + 4, (tm->tm_year + 1900) / 100);
+	p = put2(p, (tm->tm_year + 1900) % 100);
+	*p++ = ' ';
+	p = put2(p, tm->tm_hour);
+	*p++ = ':';
+	p = put2(p, tm->tm_min);
+	*p++ = ':';
+	p = put2(p, tm->tm_sec);
+	memcpy(p, " GMT", 4);
+}
+
+static void templates_build(void)
+{
+	struct status_template *t;
+	size_t i;
+
+	for (i = 0; i < RESP_STATUS_COUNT; i++) {
+		t = &templates[i];
+		memcpy(t->text, status_lines[i].text, status_lines[i].len);
+		t->len = status_lines[i].len;
+		t->len += resp_header_literal(t->text + t->len, "Date: ");
+		t->date_off = t->len;
+		t->len += DATE_LEN;
+		t->len += resp_header_literal(t->text + t->len, "\r\n");
+	}
+}
+
+/*
+ * Refresh the Date in the templates if the second has changed. Called by
+ * the event loop before it handles the events it was woken for.
+ */
+
+void resp_header_tick(void)
+{
+	struct timespec ts;
+	struct tm tm;
+	size_t i;
+	char *p;
+
+	clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+	if (ts.tv_sec == date_sec)
+		return;
+
+	if (date_sec == -1)
+		templates_build();
+	date_sec = ts.tv_sec;
+
+	gmtime_r(&ts.tv_sec, &tm);
+	format_date(templates[0].text + templates[0].date_off, &tm);
+	for (i = 1; i < RESP_STATUS_COUNT; i++)
+		memcpy(templates[i].text + templates[i].date_off,
+				templates[0].text + templates[0].date_off,
+				DATE_LEN);
+
+	p = not_found;
+	p += resp_header_status(p, RESP_404_NOT_FOUND);
+	p += resp_header_length(p, 0);
+	p += resp_header_end(p);
+	not_found_len = p - not_found;
+
+	p = too_many;
+	p += resp_header_status(p, RESP_429_TOO_MANY_REQUESTS);
+	p += resp_header_literal(p, "Retry-After: 1\r\n");
+	p += resp_header_length(p, 0);
+	p += resp_header_end(p);
+	too_many_len = p - too_many;
+}
+
+/* Status line and Date header. */
+
+size_t resp_header_status(char *buf, enum resp_status status)
+{
+	const struct status_template *t = &templates[status];
+
+	memcpy(buf, t->text, t->len);
+
+	return t->len;
+}
+
+size_t resp_header_type(char *buf, enum resp_type type)
+{
+	memcpy(buf, type_lines[type].text, type_lines[type].len);
+
+	return type_lines[type].len;
+}
+
+size_t resp_header_length(char *buf, uint64_t len)
+{
+	char *p = buf;
+
+	p += resp_header_literal(p, "Content-Length: ");
+	p += fmt_u64(p, len);
+	p += resp_header_literal(p, "\r\n");
+
+	return p - buf;
+}
+
+/* etag is the quoted tag, as made by fmt_etag(). */
+
+size_t resp_header_etag(char *buf, const char *etag, size_t len)
+{
+	char *p = buf;
+
+	p += resp_header_literal(p, "ETag: ");
+	memcpy(p, etag, len);
+	p += len;
+	p += resp_header_literal(p, "\r\n");
+
+	return p - buf;
+}
+
+size_t resp_header_end(char *buf)
+{
+	return resp_header_literal(buf, "\r\n");
+}
+
+/* A complete 404 response, dated this second. */
+
+const char *resp_not_found(size_t *len)
+{
+	*len = not_found_len;
+
+	return not_found;
+}
+
+/* A complete 429 response, dated this second. */
+
+const char *resp_too_many(size_t *len)
+{
+	*len = too_many_len;
+
+	return too_many;
+}
+
+size_t fmt_u64(char *buf, uint64_t v)
+{
+	char tmp[20];
+	char *p = tmp + sizeof(tmp);
+	size_t len;
+
+	while (v >= 100) {
+		p -= 2;
+		put2(p, v % 100);
+		v /= 100;
+	}
+	if (v >= 10) {
+		p -= 2;
+		put2(p, v);
+	} else {
+		*--p = '0' + v;
+	}
+
+	len = tmp + sizeof(tmp) - p;
+	memcpy(buf, p, len);
+
+	return len;
+}
+
+size_t fmt_etag(char *buf, uint64_t tag, int gz)
+{
+	static const char hex[] = "0123456789abcdef";
+	char *p = buf;
+	int shift;
+
+	*p++ = '"';
+	for (shift = 60; shift >= 0; shift -= 4)
+		*p++ = hex[(tag >> shift) & 0xf];
+	if (gz)
+		p += resp_header_literal(p, "-gz");
+	*p++ = '"';
+
+	return p - buf;
+}
@@ -0,0 +1,64 @@
+/*
+ * Response headers - preformatted templates filled in place
+ *
+ * 2022, Operating Systems
+ */
+
+#ifndef RESP_HEADER_H_
+#define RESP_HEADER_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+enum resp_status {
+	RESP_200_OK,
+	RESP_200_OK_HTTP11,	/* for chunked bodies */
+	RESP_304_NOT_MODIFIED,
+	RESP_404_NOT_FOUND,
+	RESP_429_TOO_MANY_REQUESTS,
+	RESP_500_INTERNAL_ERROR,
+	RESP_503_UNAVAILABLE,
+	RESP_STATUS_COUNT
+};
+
+enum resp_type {
+	RESP_TYPE_OCTET_STREAM,
+	RESP_TYPE_TEXT_PLAIN,
+	RESP_TYPE_COUNT
+};
+
+/* room a header built from the pieces below may need */
+#define RESP_HEADER_MAX		512
+
+/* quoted 64-bit entity tag, with an optional "-gz" suffix */
+#define RESP_ETAG_MAX		(sizeof("\"0123456789abcdef-gz\"") - 1)
+
+/*
+ * Each writer below stores its piece at buf, without a terminating NUL,
+ * and returns its length: p += resp_header_length(p, size); ...
+ */
+#define resp_header_literal(buf, s) \
+	(memcpy((buf), (s), sizeof(s) - 1), sizeof(s) - 1)
+
+void resp_header_tick(void);
+size_t resp_header_status(char *buf, enum resp_status status);
+size_t resp_header_type(char *buf, enum resp_type type);
+size_t resp_header_length(char *buf, uint64_t len);
+size_t resp_header_etag(char *buf, const char *etag, size_t len);
+size_t resp_header_end(char *buf);
+const char *resp_not_found(size_t *len);
+const char *resp_too_many(size_t *len);
+
+size_t fmt_u64(char *buf, uint64_t v);
+size_t fmt_etag(char *buf, uint64_t tag, int gz);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RESP_HEADER_H_ */
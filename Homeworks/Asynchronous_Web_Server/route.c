@@ -0,0 +1,154 @@
+/*
+ * Route table - longest-prefix match of request paths over a byte trie
+ *
+ * 2022, Operating Systems
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "route.h"
+#include "dir_cache.h"
+
+#define NO_NODE		-1
+
+/*
+ * Trie nodes are kept in one array and linked by index (first child, next
+ * sibling). The table is built once at startup and only read afterwards.
+ */
+struct trie_node {
+	unsigned char c;
+	int child;
+	int sibling;
+	int route;		/* index in routes[], NO_NODE if none ends here */
+};
+
+static struct trie_node *nodes;
+static int num_nodes;
+static int cap_nodes;
+
+static struct route *routes;
+static size_t num_routes;
+
+static const char *engine_names[ROUTE_ENGINE_COUNT] = {
+	[ROUTE_ENGINE_SENDFILE]	= "sendfile",
+	[ROUTE_ENGINE_AIO]	= "aio",
+	[ROUTE_ENGINE_CACHE]	= "cache",
+	[ROUTE_ENGINE_SPLICE]	= "splice",
+	[ROUTE_ENGINE_STATS]	= "stats",
+	[ROUTE_ENGINE_PACK]	= "pack",
+	[ROUTE_ENGINE_PLUGIN]	= "plugin",
+};
+
+static int node_new(unsigned char c)
+{
+	if (num_nodes == cap_nodes) {
+		int cap = cap_nodes ? 2 * cap_nodes : 64;
+		struct trie_node *n = realloc(nodes, cap * sizeof(*n));
+
+		if (n == NULL)
+			return NO_NODE;
+		nodes = n;
+		cap_nodes = cap;
+	}
+
+	nodes[num_nodes].c = c;
+	nodes[num_nodes].child = NO_NODE;
+	nodes[num_nodes].sibling = NO_NODE;
+	nodes[num_nodes].route = NO_NODE;
+
+	return num_nodes++;
+}
+
+static int node_child(int node, unsigned char c)
+{
+	int i;
+
+	for (i = nodes[node].child; i != NO_NODE; i = nodes[i].sibling)
+		if (nodes[i].c == c)
+			return i;
+
+	return NO_NODE;
+}
+
+/*
+ * Build the route table from config and open a handle on every docroot
+ * directory (one missing now stays missing). Returns 0 on success, -1 if
+ * memory could not be allocated.
+ */
+
+int route_table_build(const struct route_config *config, size_t count)
+{
+	size_t i, j;
+	int node, next;
+
+	routes = calloc(count, sizeof(*routes));
+	if (routes == NULL)
+		return -1;
+
+	if (node_new(0) == NO_NODE)
+		return -1;
+
+	for (i = 0; i < count; i++) {
+		struct route *r = &routes[i];
+
+		r->prefix = config[i].prefix;
+		r->prefix_len = strlen(r->prefix);
+		r->docroot = config[i].docroot;
+		r->docroot_len = r->docroot ? strlen(r->docroot) : 0;
+		r->dirfd = r->docroot ? dir_root_open(r->docroot) : -1;
+		r->engine = config[i].engine;
+
+		node = 0;
+		for (j = 0; j < r->prefix_len; j++) {
+			unsigned char c = r->prefix[j];
+
+			next = node_child(node, c);
+			if (next == NO_NODE) {
+				next = node_new(c);
+				if (next == NO_NODE)
+					return -1;
+				nodes[next].sibling = nodes[node].child;
+				nodes[node].child = next;
+			}
+			node = next;
+		}
+		nodes[node].route = i;
+	}
+	num_routes = count;
+
+	return 0;
+}
+
+/*
+ * Find the route with the longest prefix of path (len bytes, need not be
+ * NUL-terminated). The length of the matched prefix is stored in matched.
+ * Returns NULL if no route matches.
+ */
+
+const struct route *route_match(const char *path, size_t len, size_t *matched)
+{
+	const struct route *best = NULL;
+	int node = 0;
+	size_t i;
+
+	if (nodes == NULL)
+		return NULL;
+
+	for (i = 0; i < len; i++) {
+		node = node_child(node, (unsigned char)path[i]);
+		if (node == NO_NODE)
+			break;
+		if (nodes[node].route != NO_NODE) {
+			best = &routes[nodes[node].route];
+			*matched = i + 1;
+		}
+	}
+
+	return best;
+}
+
+const char *route_engine_name(enum route_engine engine)
+{
+	return engine_names[engine];
+}
@@ -0,0 +1,52 @@
+/*
+ * Route table - longest-prefix match of request paths over a byte trie
+ *
+ * 2022, Operating Systems
+ */
+
+#ifndef ROUTE_H_
+#define ROUTE_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/* how the content behind a route is delivered */
+enum route_engine {
+	ROUTE_ENGINE_SENDFILE,
+	ROUTE_ENGINE_AIO,
+	ROUTE_ENGINE_CACHE,
+	ROUTE_ENGINE_SPLICE,
+	ROUTE_ENGINE_STATS,
+	ROUTE_ENGINE_PACK,
+	ROUTE_ENGINE_PLUGIN,
+	ROUTE_ENGINE_COUNT
+};
+
+/* one configuration entry: URL prefix -> docroot, delivery engine */
+struct route_config {
+	const char *prefix;
+	const char *docroot;
+	enum route_engine engine;
+};
+
+struct route {
+	const char *prefix;
+	size_t prefix_len;
+	const char *docroot;
+	size_t docroot_len;
+	int dirfd;		/* O_PATH handle on docroot, -1 if none */
+	enum route_engine engine;
+};
+
+int route_table_build(const struct route_config *config, size_t count);
+const struct route *route_match(const char *path, size_t len, size_t *matched);
+const char *route_engine_name(enum route_engine engine);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ROUTE_H_ */
@@ -0,0 +1,77 @@
+/*
+ * Slab - fixed-size object allocator with a free list
+ *
+ * Objects are carved out of chunks of per_chunk objects. A freed object
+ * goes on a free list and is handed out again by the next slab_alloc().
+ * Chunks are kept for the lifetime of the process, so under connection
+ * churn the server settles at its peak footprint instead of going through
+ * malloc() and free() for every connection.
+ *
+ * 2022, Operating Systems
+ */
+
+#include <stdlib.h>
+
+#include "slab.h"
+
+#define SLAB_ALIGN	(sizeof(void *) > sizeof(long long) ? \
+				sizeof(void *) : sizeof(long long))
+
+void slab_init(struct slab *s, size_t obj_size, size_t per_chunk)
+{
+	if (obj_size < sizeof(void *))
+		obj_size = sizeof(void *);
+
+	s->obj_size = (obj_size + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1);
+	s->per_chunk = per_chunk > 0 ? per_chunk : 1;
+	s->free_list = NULL;
+	s->in_use = 0;
+	s->total = 0;
+}
+
+/* Carve a new chunk into objects and push them all on the free list. */
+
+static int slab_grow(struct slab *s)
+{
+	char *chunk = malloc(s->obj_size * s->per_chunk);
+	size_t i;
+
+	if (chunk == NULL)
+		return -1;
+
+	for (i = s->per_chunk; i > 0; i--) {
+		void **obj = (void **)(chunk + (i - 1) * s->obj_size);
+
+		*obj = s->free_list;
+		s->free_list = obj;
+	}
+	s->total += s->per_chunk;
+
+	return 0;
+}
+
+/* Returns an uninitialized object, or NULL when out of memory. */
+
+void *slab_alloc(struct slab *s)
+{
+	void **obj;
+
+	if (s->free_list == NULL && slab_grow(s) < 0)
+		return NULL;
+
+	obj = s->free_list;
+	s->free_list = *obj;
+	s->in_use++;
+
+	return obj;
+}
+
+void slab_free(struct slab *s, void *obj)
+{
+	if (obj == NULL)
+		return;
+
+	*(void **)obj = s->free_list;
+	s->free_list = obj;
+	s->in_use--;
+}
@@ -0,0 +1,32 @@
+/*
+ * Slab - fixed-size object allocator with a free list
+ *
+ * 2022, Operating Systems
+ */
+
+#ifndef SLAB_H_
+#define SLAB_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+struct slab {
+	size_t obj_size;	/* rounded up to hold the free list link */
+	size_t per_chunk;	/* objects carved out of one allocation */
+	void *free_list;
+	size_t in_use;
+	size_t total;
+};
+
+void slab_init(struct slab *s, size_t obj_size, size_t per_chunk);
+void *slab_alloc(struct slab *s);
+void slab_free(struct slab *s, void *obj);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SLAB_H_ */
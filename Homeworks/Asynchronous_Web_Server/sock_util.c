@@ -26,9 +26,12 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <linux/filter.h>
 #include <unistd.h>
 #include <fcntl.h>
 
@@ -81,6 +84,23 @@ int tcp_close_connection(int sockfd)
  */
 
 int tcp_create_listener(unsigned short port, int backlog)
+{
+	struct listen_opts opts = { .backlog = backlog };
+
+	return tcp_create_listener_opts(port, &opts);
+}
+
+/*
+ * Create a server socket with the options in opts. With defer_accept the
+ * kernel only reports a connection once its first data has arrived; with
+ * fastopen, clients holding a cookie may send their request in the SYN
+ * (the server side also has to be enabled in net.ipv4.tcp_fastopen).
+ * These are only optimizations: if the kernel refuses one, the listener
+ * works without it.
+ */
+
+int tcp_create_listener_opts(unsigned short port,
+		const struct listen_opts *opts)
 {
 	struct sockaddr_in address;
 	int listenfd;
@@ -95,6 +115,32 @@ int tcp_create_listener(unsigned short port, int backlog)
 				&sock_opt, sizeof(int));
 	DIE(rc < 0, "setsockopt");
 
+	if (opts->defer_accept > 0) {
+		rc = setsockopt(listenfd, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+				&opts->defer_accept, sizeof(int));
+		if (rc < 0)
+			ERR("setsockopt TCP_DEFER_ACCEPT");
+	}
+
+	if (opts->fastopen > 0) {
+		rc = setsockopt(listenfd, IPPROTO_TCP, TCP_FASTOPEN,
+				&opts->fastopen, sizeof(int));
+		if (rc < 0)
+			ERR("setsockopt TCP_FASTOPEN");
+	}
+
+	if (opts->reuseport) {
+		rc = setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT,
+				&sock_opt, sizeof(int));
+		DIE(rc < 0, "setsockopt SO_REUSEPORT");
+
+		/* used by kernels that steer without a program */
+		rc = setsockopt(listenfd, SOL_SOCKET, SO_INCOMING_CPU,
+				&opts->cpu, sizeof(int));
+		if (rc < 0)
+			ERR("setsockopt SO_INCOMING_CPU");
+	}
+
 	memset(&address, 0, sizeof(address));
 	address.sin_family = AF_INET;
 	address.sin_port = htons(port);
@@ -103,6 +149,135 @@ int tcp_create_listener(unsigned short port, int backlog)
 	rc = bind(listenfd, (SSA *) &address, sizeof(address));
 	DIE(rc < 0, "bind");
 
+	rc = listen(listenfd, opts->backlog);
+	DIE(rc < 0, "listen");
+
+	return listenfd;
+}
+
+/*
+ * Connections waiting in the accept queue of a TCP listener, and the
+ * queue's size (the backlog, capped by net.core.somaxconn). Returns 0, or
+ * -1 if the kernel does not say.
+ */
+
+int listener_queue(int listenfd, unsigned int *len, unsigned int *max)
+{
+	struct tcp_info info;
+	socklen_t info_len = sizeof(info);
+
+	if (getsockopt(listenfd, IPPROTO_TCP, TCP_INFO, &info, &info_len) < 0)
+		return -1;
+
+	/* on a listener these two report the accept queue */
+	*len = info.tcpi_unacked;
+	*max = info.tcpi_sacked;
+
+	return 0;
+}
+
+/* listeners a reuseport group can steer to */
+#define STEER_CPUS_MAX		64
+
+/*
+ * Make the SO_REUSEPORT group of listenfd hand each new connection to the
+ * listener of the CPU that received it: the i-th listener to start
+ * listening takes the flows of cpus[i]. Flows on any other CPU are spread
+ * by CPU number. Returns 0, or -1 if the kernel has no such steering (the
+ * group then picks listeners by flow hash).
+ */
+
+int tcp_steer_by_cpu(int listenfd, const int *cpus, int n)
+{
+	struct sock_filter code[2 * STEER_CPUS_MAX + 3];
+	struct sock_fprog prog;
+	int i, len = 0;
+
+	if (n > STEER_CPUS_MAX)
+		n = STEER_CPUS_MAX;
+
+	/* A = CPU the packet came in on */
+	code[len++] = (struct sock_filter)
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU);
+	for (i = 0; i < n; i++) {
+		code[len++] = (struct sock_filter)
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, cpus[i], 0, 1);
+		code[len++] = (struct sock_filter)
+			BPF_STMT(BPF_RET | BPF_K, i);
+	}
+	code[len++] = (struct sock_filter)
+		BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, n);
+	code[len++] = (struct sock_filter)
+		BPF_STMT(BPF_RET | BPF_A, 0);
+
+	prog.len = len;
+	prog.filter = code;
+
+	return setsockopt(listenfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+			&prog, sizeof(prog));
+}
+
+/* Fill in the address of the Unix domain socket at path. */
+
+static int unix_address(const char *path, struct sockaddr_un *address)
+{
+	if (strlen(path) >= sizeof(address->sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	memset(address, 0, sizeof(*address));
+	address->sun_family = AF_UNIX;
+	strcpy(address->sun_path, path);
+
+	return 0;
+}
+
+/*
+ * Connect to a server listening on the Unix domain socket at path.
+ */
+
+int unix_connect_to_server(const char *path)
+{
+	struct sockaddr_un server_addr;
+	int s;
+	int rc;
+
+	rc = unix_address(path, &server_addr);
+	DIE(rc < 0, "unix_address");
+
+	s = socket(PF_UNIX, SOCK_STREAM, 0);
+	DIE(s < 0, "socket");
+
+	rc = connect(s, (SSA *) &server_addr, sizeof(server_addr));
+	DIE(rc < 0, "connect");
+
+	return s;
+}
+
+/*
+ * Create a server socket bound to the Unix domain socket at path. A socket
+ * file left there by an earlier run is replaced.
+ */
+
+int unix_create_listener(const char *path, int backlog)
+{
+	struct sockaddr_un address;
+	int listenfd;
+	int rc;
+
+	rc = unix_address(path, &address);
+	DIE(rc < 0, "unix_address");
+
+	listenfd = socket(PF_UNIX, SOCK_STREAM, 0);
+	DIE(listenfd < 0, "socket");
+
+	rc = unlink(path);
+	DIE(rc < 0 && errno != ENOENT, "unlink");
+
+	rc = bind(listenfd, (SSA *) &address, sizeof(address));
+	DIE(rc < 0, "bind");
+
 	rc = listen(listenfd, backlog);
 	DIE(rc < 0, "listen");
 
@@ -111,18 +286,24 @@ int tcp_create_listener(unsigned short port, int backlog)
 
 /*
  * Use getpeername(2) to extract remote peer address. Fill buffer with
- * address format IP_address:port (e.g. 192.168.0.1:22).
+ * address format IP_address:port (e.g. 192.168.0.1:22), or "unix" for a
+ * peer on a Unix domain socket.
  */
 
 int get_peer_address(int sockfd, char *buf, size_t len)
 {
-	struct sockaddr_in addr;
-	socklen_t addrlen = sizeof(struct sockaddr_in);
+	struct sockaddr_storage ss;
+	struct sockaddr_in *addr = (struct sockaddr_in *) &ss;
+	socklen_t addrlen = sizeof(ss);
 
-	if (getpeername(sockfd, (SSA *) &addr, &addrlen) < 0)
+	if (getpeername(sockfd, (SSA *) &ss, &addrlen) < 0)
 		return -1;
 
-	sprintf(buf, "%s:%d", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+	if (ss.ss_family == AF_UNIX)
+		snprintf(buf, len, "unix");
+	else
+		snprintf(buf, len, "%s:%d", inet_ntoa(addr->sin_addr),
+				ntohs(addr->sin_port));
 
 	return 0;
 }
@@ -35,10 +35,24 @@ extern "C" {
 /* "shortcut" for struct sockaddr structure */
 #define SSA			struct sockaddr
 
+/* listener options; zero turns an option off */
+struct listen_opts {
+	int backlog;
+	int defer_accept;	/* seconds a connection may wait for data */
+	int fastopen;		/* queue of pending TCP Fast Open requests */
+	int reuseport;		/* one of a group sharing the port */
+	int cpu;		/* with reuseport: CPU whose flows it takes */
+};
 
 int tcp_connect_to_server(const char *name, unsigned short port);
 int tcp_close_connection(int s);
 int tcp_create_listener(unsigned short port, int backlog);
+int tcp_create_listener_opts(unsigned short port,
+		const struct listen_opts *opts);
+int listener_queue(int listenfd, unsigned int *len, unsigned int *max);
+int tcp_steer_by_cpu(int listenfd, const int *cpus, int n);
+int unix_connect_to_server(const char *path);
+int unix_create_listener(const char *path, int backlog);
 int get_peer_address(int sockfd, char *buf, size_t len);
 
 #ifdef __cplusplus
@@ -0,0 +1,343 @@
+/*
+ * Server statistics - counters exposed through the stats route
+ *
+ * 2022, Operating Systems
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "aws.h"
+#include "sock_util.h"
+#include "stats.h"
+
+struct aws_stats aws_stats;
+
+/* TCP listener whose accept queue is reported, -1 if none */
+static int stats_listenfd = -1;
+
+/* worker process these counters belong to, -1 if there is only one */
+static int stats_worker_index = -1;
+static int stats_worker_cpu;
+
+/*
+ * Kernel TCP counters (TcpExt in /proc/net/netstat) worth watching next
+ * to the listener options. They cover the whole network namespace, not
+ * only this server.
+ */
+static const struct {
+	const char *kernel;
+	const char *name;
+} tcp_counters[] = {
+	{ "ListenOverflows",		"tcp_listen_overflows" },
+	{ "ListenDrops",		"tcp_listen_drops" },
+	{ "TCPDeferAcceptDrop",		"tcp_defer_accept_drops" },
+	{ "TCPFastOpenPassive",		"tcp_fastopen_passive" },
+	{ "TCPFastOpenPassiveFail",	"tcp_fastopen_passive_fail" },
+	{ "TCPFastOpenListenOverflow",	"tcp_fastopen_listen_overflows" },
+	{ "TCPFastOpenCookieReqd",	"tcp_fastopen_cookie_reqd" },
+};
+
+#define NUM_TCP_COUNTERS	(sizeof(tcp_counters) / sizeof(tcp_counters[0]))
+
+/* append one formatted line, never writing past size */
+static size_t stats_line(char *buf, size_t size, size_t pos,
+		const char *format, ...)
+{
+	va_list ap;
+	int rc;
+
+	if (pos >= size)
+		return pos;
+
+	va_start(ap, format);
+	rc = vsnprintf(buf + pos, size - pos, format, ap);
+	va_end(ap);
+
+	if (rc < 0)
+		return pos;
+	if ((size_t)rc >= size - pos)
+		return size - 1;
+
+	return pos + rc;
+}
+
+/* A connection was torn down because an operation on it failed with err. */
+
+void stats_connection_error(int err)
+{
+	if (err <= 0 || err >= STATS_ERRNO_MAX)
+		err = 0;
+
+	aws_stats.connection_errors[err]++;
+}
+
+void stats_listener(int listenfd)
+{
+	stats_listenfd = listenfd;
+}
+
+void stats_worker(int index, int cpu)
+{
+	stats_worker_index = index;
+	stats_worker_cpu = cpu;
+}
+
+/*
+ * Append the tcp_counters. /proc/net/netstat has a line of names followed
+ * by a line of values for each group; the two TcpExt lines are walked
+ * side by side.
+ */
+
+static size_t stats_tcp_counters(char *buf, size_t size, size_t pos)
+{
+	const char *found[NUM_TCP_COUNTERS] = { NULL };
+	char text[16384];
+	char *names, *values, *n, *v, *sn, *sv;
+	size_t len, i;
+	FILE *f;
+
+	f = fopen("/proc/net/netstat", "r");
+	if (f == NULL)
+		return pos;
+	len = fread(text, 1, sizeof(text) - 1, f);
+	fclose(f);
+	text[len] = '\0';
+
+	names = strstr(text, "TcpExt:");
+	if (names == NULL)
+		return pos;
+	values = strstr(names + 1, "TcpExt:");
+	if (values == NULL)
+		return pos;
+	names[strcspn(names, "\n")] = '\0';
+	values[strcspn(values, "\n")] = '\0';
+
+	n = strtok_r(names, " ", &sn);
+	v = strtok_r(values, " ", &sv);
+	while (n != NULL && v != NULL) {
+		for (i = 0; i < NUM_TCP_COUNTERS; i++)
+			if (strcmp(n, tcp_counters[i].kernel) == 0)
+				found[i] = v;
+		n = strtok_r(NULL, " ", &sn);
+		v = strtok_r(NULL, " ", &sv);
+	}
+
+	for (i = 0; i < NUM_TCP_COUNTERS; i++)
+		if (found[i] != NULL)
+			pos = stats_line(buf, size, pos, "%s %s\n",
+					tcp_counters[i].name, found[i]);
+
+	return pos;
+}
+
+/*
+ * Print all counters as "name value" lines into buf. Returns the number of
+ * bytes written (excluding the terminating NUL).
+ */
+
+size_t stats_format(char *buf, size_t size)
+{
+	struct rusage ru;
+	unsigned int queue, queue_max;
+	size_t pos = 0;
+	int i;
+
+	if (stats_worker_index >= 0) {
+		pos = stats_line(buf, size, pos, "worker %d\n",
+				stats_worker_index);
+		pos = stats_line(buf, size, pos, "worker_cpu %d\n",
+				stats_worker_cpu);
+	}
+	pos = stats_line(buf, size, pos, "connections_accepted %" PRIu64 "\n",
+			aws_stats.connections_accepted);
+	pos = stats_line(buf, size, pos, "connections_unix %" PRIu64 "\n",
+			aws_stats.connections_unix);
+	pos = stats_line(buf, size, pos, "connections_other_cpu %" PRIu64 "\n",
+			aws_stats.connections_other_cpu);
+	pos = stats_line(buf, size, pos, "connections_active %" PRIu64 "\n",
+			aws_stats.connections_active);
+	pos = stats_line(buf, size, pos, "connections_draining %" PRIu64 "\n",
+			aws_stats.connections_draining);
+	pos = stats_line(buf, size, pos, "drain_timeouts %" PRIu64 "\n",
+			aws_stats.drain_timeouts);
+	pos = stats_line(buf, size, pos, "connections_shed %" PRIu64 "\n",
+			aws_stats.connections_shed);
+	pos = stats_line(buf, size, pos, "accept_pauses %" PRIu64 "\n",
+			aws_stats.accept_pauses);
+	pos = stats_line(buf, size, pos, "requests_throttled %" PRIu64 "\n",
+			aws_stats.requests_throttled);
+	pos = stats_line(buf, size, pos, "admit_clients %" PRIu64 "\n",
+			aws_stats.admit_clients);
+	pos = stats_line(buf, size, pos, "admit_untracked %" PRIu64 "\n",
+			aws_stats.admit_untracked);
+	pos = stats_line(buf, size, pos, "requests %" PRIu64 "\n",
+			aws_stats.requests);
+	pos = stats_line(buf, size, pos, "requests_aborted %" PRIu64 "\n",
+			aws_stats.requests_aborted);
+	pos = stats_line(buf, size, pos, "responses_not_found %" PRIu64 "\n",
+			aws_stats.responses_not_found);
+
+	pos = stats_line(buf, size, pos, "responses_not_modified %" PRIu64
+			"\n", aws_stats.responses_not_modified);
+	pos = stats_line(buf, size, pos, "offload_jobs %" PRIu64 "\n",
+			aws_stats.offload_jobs);
+	pos = stats_line(buf, size, pos, "offload_inline %" PRIu64 "\n",
+			aws_stats.offload_inline);
+	pos = stats_line(buf, size, pos, "offload_waits %" PRIu64 "\n",
+			aws_stats.offload_waits);
+	pos = stats_line(buf, size, pos, "plugin_calls %" PRIu64 "\n",
+			aws_stats.plugin_calls);
+	pos = stats_line(buf, size, pos, "plugin_rejected %" PRIu64 "\n",
+			aws_stats.plugin_rejected);
+	pos = stats_line(buf, size, pos, "plugin_failures %" PRIu64 "\n",
+			aws_stats.plugin_failures);
+	pos = stats_line(buf, size, pos, "plugin_queue_depth %" PRIu64 "\n",
+			aws_stats.plugin_queue_depth);
+	pos = stats_line(buf, size, pos, "plugin_queue_depth_max %" PRIu64 "\n",
+			aws_stats.plugin_queue_depth_max);
+	pos = stats_line(buf, size, pos, "plugin_latency_us %" PRIu64 "\n",
+			aws_stats.plugin_latency_us);
+	pos = stats_line(buf, size, pos, "plugin_latency_max_us %" PRIu64 "\n",
+			aws_stats.plugin_latency_max_us);
+
+	for (i = 0; i < STATS_ERRNO_MAX; i++) {
+		const char *name = i > 0 ? strerrorname_np(i) : NULL;
+
+		if (aws_stats.connection_errors[i] == 0)
+			continue;
+		pos = stats_line(buf, size, pos,
+				"connection_errors_%s %" PRIu64 "\n",
+				name != NULL ? name : "other",
+				aws_stats.connection_errors[i]);
+	}
+
+	for (i = 0; i < ROUTE_ENGINE_COUNT; i++) {
+		pos = stats_line(buf, size, pos,
+				"engine_%s_requests %" PRIu64 "\n",
+				route_engine_name(i),
+				aws_stats.engine_requests[i]);
+		pos = stats_line(buf, size, pos,
+				"engine_%s_bytes %" PRIu64 "\n",
+				route_engine_name(i),
+				aws_stats.engine_bytes[i]);
+	}
+
+	pos = stats_line(buf, size, pos, "cache_hits %" PRIu64 "\n",
+			aws_stats.cache_hits);
+	pos = stats_line(buf, size, pos, "cache_misses %" PRIu64 "\n",
+			aws_stats.cache_misses);
+	pos = stats_line(buf, size, pos, "cache_evictions %" PRIu64 "\n",
+			aws_stats.cache_evictions);
+	pos = stats_line(buf, size, pos, "cache_bytes %" PRIu64 "\n",
+			aws_stats.cache_bytes);
+	pos = stats_line(buf, size, pos, "zerocopy_sends %" PRIu64 "\n",
+			aws_stats.zerocopy_sends);
+	pos = stats_line(buf, size, pos, "zerocopy_bytes %" PRIu64 "\n",
+			aws_stats.zerocopy_bytes);
+	pos = stats_line(buf, size, pos, "zerocopy_copied %" PRIu64 "\n",
+			aws_stats.zerocopy_copied);
+	pos = stats_line(buf, size, pos, "zerocopy_fallbacks %" PRIu64 "\n",
+			aws_stats.zerocopy_fallbacks);
+	pos = stats_line(buf, size, pos, "aio_blocks %" PRIu64 "\n",
+			aws_stats.aio_blocks);
+	pos = stats_line(buf, size, pos, "tx_chunk_probes %" PRIu64 "\n",
+			aws_stats.tx_chunk_probes);
+	pos = stats_line(buf, size, pos, "tx_chunk_grows %" PRIu64 "\n",
+			aws_stats.tx_chunk_grows);
+	pos = stats_line(buf, size, pos, "tx_chunk_shrinks %" PRIu64 "\n",
+			aws_stats.tx_chunk_shrinks);
+	pos = stats_line(buf, size, pos, "neg_cache_hits %" PRIu64 "\n",
+			aws_stats.neg_cache_hits);
+	pos = stats_line(buf, size, pos, "neg_cache_flushes %" PRIu64 "\n",
+			aws_stats.neg_cache_flushes);
+	pos = stats_line(buf, size, pos, "paths_rejected %" PRIu64 "\n",
+			aws_stats.paths_rejected);
+	pos = stats_line(buf, size, pos, "fs_watch_events %" PRIu64 "\n",
+			aws_stats.fs_watch_events);
+	pos = stats_line(buf, size, pos, "fs_watch_overflows %" PRIu64 "\n",
+			aws_stats.fs_watch_overflows);
+	pos = stats_line(buf, size, pos, "page_cache_hits %" PRIu64 "\n",
+			aws_stats.page_cache_hits);
+	pos = stats_line(buf, size, pos, "page_cache_misses %" PRIu64 "\n",
+			aws_stats.page_cache_misses);
+	pos = stats_line(buf, size, pos, "loop_busy_us %" PRIu64 "\n",
+			aws_stats.loop_busy_us);
+	pos = stats_line(buf, size, pos, "loop_spin_us %" PRIu64 "\n",
+			aws_stats.loop_spin_us);
+	pos = stats_line(buf, size, pos, "loop_idle_us %" PRIu64 "\n",
+			aws_stats.loop_idle_us);
+	pos = stats_line(buf, size, pos, "loop_spin_hits %" PRIu64 "\n",
+			aws_stats.loop_spin_hits);
+	pos = stats_line(buf, size, pos, "loop_sleeps %" PRIu64 "\n",
+			aws_stats.loop_sleeps);
+
+	if (stats_listenfd >= 0 &&
+			listener_queue(stats_listenfd, &queue, &queue_max) == 0) {
+		pos = stats_line(buf, size, pos, "listen_queue %u\n", queue);
+		pos = stats_line(buf, size, pos, "listen_queue_max %u\n",
+				queue_max);
+	}
+	pos = stats_tcp_counters(buf, size, pos);
+
+	if (getrusage(RUSAGE_SELF, &ru) == 0) {
+		pos = stats_line(buf, size, pos, "cpu_user_us %ld\n",
+				ru.ru_utime.tv_sec * 1000000L +
+				ru.ru_utime.tv_usec);
+		pos = stats_line(buf, size, pos, "cpu_system_us %ld\n",
+				ru.ru_stime.tv_sec * 1000000L +
+				ru.ru_stime.tv_usec);
+	}
+
+	return pos;
+}
+
+/* One snapshot, then the end of the body. */
+
+static void stats_produce_once(struct stream *s)
+{
+	char buf[BUFSIZ];
+
+	stream_write(s, buf, stats_format(buf, sizeof(buf)));
+	stream_end(s);
+}
+
+/*
+ * A snapshot every AWS_STATS_FOLLOW_MS until the client goes away. Between
+ * snapshots the stream sleeps and produce() has nothing to add.
+ */
+
+static void stats_produce_follow(struct stream *s)
+{
+	char buf[BUFSIZ];
+
+	if (s->sleeping)
+		return;
+
+	stream_write(s, buf, stats_format(buf, sizeof(buf)));
+	stream_sleep(s, AWS_STATS_FOLLOW_MS);
+}
+
+static const struct stream_ops stats_once_ops = {
+	.produce = stats_produce_once,
+};
+
+static const struct stream_ops stats_follow_ops = {
+	.produce = stats_produce_follow,
+};
+
+/*
+ * Stream the counters on s: once, or over and over if follow is set.
+ * Returns 0, or -1 if the stream could not be opened.
+ */
+
+int stats_stream_open(struct stream *s, int follow, int chunked)
+{
+	return stream_open(s, follow ? &stats_follow_ops : &stats_once_ops,
+			NULL, chunked);
+}
@@ -0,0 +1,90 @@
+/*
+ * Server statistics - counters exposed through the stats route
+ *
+ * 2022, Operating Systems
+ */
+
+#ifndef STATS_H_
+#define STATS_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "route.h"
+#include "stream.h"
+
+/* connection errors are counted by errno; slot 0 takes the rest */
+#define STATS_ERRNO_MAX		134
+
+struct aws_stats {
+	uint64_t connections_accepted;
+	uint64_t connections_unix;	/* accepted on the Unix socket */
+	uint64_t connections_other_cpu;	/* packets arrive on another CPU */
+	uint64_t connections_active;
+	uint64_t connections_draining;
+	uint64_t drain_timeouts;
+	uint64_t connections_shed;	/* closed right after accept() */
+	uint64_t accept_pauses;		/* listeners paused, out of fds */
+	uint64_t requests_throttled;	/* answered 429 */
+	uint64_t admit_clients;		/* addresses with a bucket */
+	uint64_t admit_untracked;	/* client table full */
+	uint64_t requests;
+	uint64_t requests_aborted;
+	uint64_t connection_errors[STATS_ERRNO_MAX];	/* torn down by errno */
+	uint64_t responses_not_found;
+	uint64_t responses_not_modified;
+	uint64_t offload_jobs;
+	uint64_t offload_inline;
+	uint64_t offload_waits;		/* opens that waited for queue room */
+	uint64_t plugin_calls;
+	uint64_t plugin_rejected;	/* queue full: 503 */
+	uint64_t plugin_failures;
+	uint64_t plugin_queue_depth;	/* calls queued or running */
+	uint64_t plugin_queue_depth_max;
+	uint64_t plugin_latency_us;	/* handler run time, summed */
+	uint64_t plugin_latency_max_us;
+	uint64_t engine_requests[ROUTE_ENGINE_COUNT];
+	uint64_t engine_bytes[ROUTE_ENGINE_COUNT];
+	uint64_t cache_hits;
+	uint64_t cache_misses;
+	uint64_t cache_evictions;
+	uint64_t cache_bytes;
+	uint64_t zerocopy_sends;
+	uint64_t zerocopy_bytes;
+	uint64_t zerocopy_copied;	/* the kernel copied after all */
+	uint64_t zerocopy_fallbacks;	/* sent with a copy instead */
+	uint64_t aio_blocks;
+	uint64_t tx_chunk_probes;
+	uint64_t tx_chunk_grows;
+	uint64_t tx_chunk_shrinks;
+	uint64_t neg_cache_hits;
+	uint64_t neg_cache_flushes;
+	uint64_t paths_rejected;	/* resolved outside the docroot */
+	uint64_t fs_watch_events;
+	uint64_t fs_watch_overflows;
+	uint64_t page_cache_hits;
+	uint64_t page_cache_misses;
+	uint64_t loop_busy_us;		/* handling events */
+	uint64_t loop_spin_us;		/* busy polling for events */
+	uint64_t loop_idle_us;		/* asleep in epoll_wait() */
+	uint64_t loop_spin_hits;	/* busy polls that found events */
+	uint64_t loop_sleeps;		/* waits that had to sleep */
+};
+
+extern struct aws_stats aws_stats;
+
+size_t stats_format(char *buf, size_t size);
+void stats_listener(int listenfd);
+void stats_worker(int index, int cpu);
+void stats_connection_error(int err);
+int stats_stream_open(struct stream *s, int follow, int chunked);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STATS_H_ */
@@ -0,0 +1,285 @@
+/*
+ * Streamed responses - bodies produced while they are sent
+ *
+ * A streamed body has no length known up front. HTTP/1.1 clients get it
+ * with Transfer-Encoding: chunked, each stream_write() becoming one chunk;
+ * HTTP/1.0 clients get the bytes as they are and the end of the body is
+ * the end of the connection.
+ *
+ * Backpressure comes from the buffer: it holds at most AWS_STREAM_BUF
+ * framed bytes, stream_write() takes only what fits, and produce() is only
+ * called again once the buffer has gone to the socket. A stream with
+ * nothing to send is parked and costs nothing until stream_wake(), or its
+ * stream_sleep() timer, brings it back.
+ *
+ * 2022, Operating Systems
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "aws.h"
+#include "stream.h"
+#include "resp_header.h"
+
+/* "<hex length>\r\n" before the data and "\r\n" after it */
+#define CHUNK_OVERHEAD	(16 + 4)
+
+/* last chunk, always kept room for */
+#define CHUNK_LAST	"0\r\n\r\n"
+
+static struct stream *timer_head;
+static struct stream *timer_tail;
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void timer_unlink(struct stream *s)
+{
+	if (!s->sleeping)
+		return;
+
+	if (s->timer_prev != NULL)
+		s->timer_prev->timer_next = s->timer_next;
+	else
+		timer_head = s->timer_next;
+
+	if (s->timer_next != NULL)
+		s->timer_next->timer_prev = s->timer_prev;
+	else
+		timer_tail = s->timer_prev;
+
+	s->timer_prev = s->timer_next = NULL;
+	s->sleeping = 0;
+}
+
+/* Insert from the tail: streams mostly sleep for the same intervals. */
+
+static void timer_insert(struct stream *s)
+{
+	struct stream *t = timer_tail;
+
+	while (t != NULL && t->wake_at > s->wake_at)
+		t = t->timer_prev;
+
+	s->timer_prev = t;
+	s->timer_next = t != NULL ? t->timer_next : timer_head;
+	if (s->timer_next != NULL)
+		s->timer_next->timer_prev = s;
+	else
+		timer_tail = s;
+	if (t != NULL)
+		t->timer_next = s;
+	else
+		timer_head = s;
+	s->sleeping = 1;
+}
+
+/*
+ * Start a stream on s for the producer ops (priv is left for it). Returns
+ * 0, or -1 if the buffer could not be allocated.
+ */
+
+int stream_open(struct stream *s, const struct stream_ops *ops, void *priv,
+		int chunked)
+{
+	s->buf = malloc(AWS_STREAM_BUF);
+	if (s->buf == NULL)
+		return -1;
+
+	s->off = s->len = 0;
+	s->chunked = chunked;
+	s->ended = 0;
+	s->aborted = 0;
+	s->parked = 0;
+	s->ops = ops;
+	s->priv = priv;
+	s->timer_prev = s->timer_next = NULL;
+	s->sleeping = 0;
+
+	return 0;
+}
+
+/* Finish or abandon the stream; does nothing if it is not open. */
+
+void stream_close(struct stream *s)
+{
+	if (s->buf == NULL)
+		return;
+
+	timer_unlink(s);
+	if (s->ops->close != NULL)
+		s->ops->close(s);
+	free(s->buf);
+	s->buf = NULL;
+}
+
+/*
+ * Queue up to len bytes of body. Returns how many were taken, 0 if the
+ * buffer is full (produce() will be called when it has drained) or the
+ * stream has ended.
+ */
+
+size_t stream_write(struct stream *s, const void *data, size_t len)
+{
+	size_t room = AWS_STREAM_BUF - s->len - (sizeof(CHUNK_LAST) - 1);
+	char *p = s->buf + s->len;
+
+	if (s->ended || len == 0)
+		return 0;
+
+	if (s->chunked) {
+		if (room <= CHUNK_OVERHEAD)
+			return 0;
+		room -= CHUNK_OVERHEAD;
+	}
+	if (len > room)
+		len = room;
+	if (len == 0)
+		return 0;
+
+	if (s->chunked) {
+		static const char hex[] = "0123456789abcdef";
+		char size[16];
+		int n = 0;
+		size_t v = len;
+
+		do {
+			size[n++] = hex[v & 0xf];
+			v >>= 4;
+		} while (v != 0);
+		while (n > 0)
+			*p++ = size[--n];
+		p += resp_header_literal(p, "\r\n");
+	}
+	memcpy(p, data, len);
+	p += len;
+	if (s->chunked)
+		p += resp_header_literal(p, "\r\n");
+	s->len = p - s->buf;
+
+	stream_wake(s);
+
+	return len;
+}
+
+/* No more body: the stream finishes once what is queued has been sent. */
+
+void stream_end(struct stream *s)
+{
+	if (s->ended)
+		return;
+
+	if (s->chunked)
+		s->len += resp_header_literal(s->buf + s->len, CHUNK_LAST);
+	s->ended = 1;
+
+	stream_wake(s);
+}
+
+/*
+ * The body cannot be completed. What is queued is still sent, then the
+ * sender gives up on the connection instead of ending the body.
+ */
+
+void stream_abort(struct stream *s)
+{
+	s->aborted = 1;
+
+	stream_wake(s);
+}
+
+/* Have produce() called again in ms milliseconds, unless woken before. */
+
+void stream_sleep(struct stream *s, unsigned int ms)
+{
+	timer_unlink(s);
+	s->wake_at = now_ms() + ms;
+	timer_insert(s);
+}
+
+/* Hold a stream that has nothing to send yet until stream_wake(). */
+
+void stream_park(struct stream *s)
+{
+	s->parked = 1;
+}
+
+/* Put a parked stream back to work; a pending sleep is cancelled. */
+
+void stream_wake(struct stream *s)
+{
+	if (!s->parked)
+		return;
+
+	timer_unlink(s);
+	s->parked = 0;
+	s->resume(s);
+}
+
+/*
+ * Called by the sender when everything queued is out. Returns 1 if the
+ * producer queued more, 0 if the stream is over, -1 if it was parked and
+ * -2 if it was aborted.
+ */
+
+int stream_fill(struct stream *s)
+{
+	s->off = s->len = 0;
+	if (s->aborted)
+		return -2;
+	if (s->ended)
+		return 0;
+
+	s->ops->produce(s);
+	if (s->len > 0)
+		return 1;
+	if (s->aborted)
+		return -2;
+	if (s->ended)
+		return 0;
+
+	s->parked = 1;
+
+	return -1;
+}
+
+/* len bytes of the buffer went to the socket. */
+
+void stream_consume(struct stream *s, size_t len)
+{
+	s->off += len;
+}
+
+/*
+ * Wake the streams whose sleep is over. Returns the milliseconds until the
+ * next wakeup, or -1 if no stream sleeps.
+ */
+
+int stream_expire(void)
+{
+	uint64_t now;
+
+	if (timer_head == NULL)
+		return -1;
+
+	now = now_ms();
+	while (timer_head != NULL && timer_head->wake_at <= now) {
+		struct stream *s = timer_head;
+
+		timer_unlink(s);
+		stream_wake(s);
+	}
+
+	if (timer_head == NULL)
+		return -1;
+
+	return (int)(timer_head->wake_at - now);
+}
@@ -0,0 +1,73 @@
+/*
+ * Streamed responses - bodies produced while they are sent
+ *
+ * 2022, Operating Systems
+ */
+
+#ifndef STREAM_H_
+#define STREAM_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct stream;
+
+/*
+ * A producer fills the stream from produce(), which is called whenever
+ * everything written so far has gone to the socket. It writes what it has
+ * with stream_write() and, once there is no more, calls stream_end(). If
+ * it has nothing yet it returns without writing, after stream_sleep() if
+ * it wants to be asked again later; otherwise it calls stream_write() or
+ * stream_wake() itself when data shows up. A producer that fails after
+ * the response has started calls stream_abort() instead, and the
+ * connection is cut off so that the client sees a truncated body. close()
+ * is called once, when the response is finished or abandoned.
+ */
+struct stream_ops {
+	void (*produce)(struct stream *s);
+	void (*close)(struct stream *s);
+};
+
+struct stream {
+	char *buf;		/* framed bytes not sent yet, NULL if unused */
+	size_t off;		/* first byte not sent */
+	size_t len;
+	int chunked;		/* Transfer-Encoding: chunked framing */
+	int ended;		/* stream_end() was called */
+	int aborted;		/* stream_abort() was called */
+	int parked;		/* nothing to send, waiting for a wakeup */
+	const struct stream_ops *ops;
+	void *priv;
+
+	/* called by stream_wake() to put a parked stream back to work */
+	void (*resume)(struct stream *s);
+
+	/* sleeping streams, soonest wakeup first */
+	uint64_t wake_at;
+	struct stream *timer_prev;
+	struct stream *timer_next;
+	int sleeping;
+};
+
+int stream_open(struct stream *s, const struct stream_ops *ops, void *priv,
+		int chunked);
+void stream_close(struct stream *s);
+size_t stream_write(struct stream *s, const void *data, size_t len);
+void stream_end(struct stream *s);
+void stream_abort(struct stream *s);
+void stream_sleep(struct stream *s, unsigned int ms);
+void stream_park(struct stream *s);
+void stream_wake(struct stream *s);
+int stream_fill(struct stream *s);
+void stream_consume(struct stream *s, size_t len);
+int stream_expire(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STREAM_H_ */
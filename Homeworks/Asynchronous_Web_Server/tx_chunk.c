@@ -0,0 +1,92 @@
+/*
+ * Transmit chunks - block sizes that follow how fast a peer drains
+ *
+ * The AIO engine reads the file into a user buffer one block at a time.
+ * A fixed block is wrong both ways: a fast peer empties the socket buffer
+ * faster than small blocks are read and written, so it costs two syscalls
+ * per few kilobytes, while a large block for a slow peer is memory that
+ * sits there until the peer gets to it.
+ *
+ * The block is therefore sized from what the socket can take: the free
+ * space of its send buffer (SO_SNDBUF less SIOCOUTQ), but no more than two
+ * congestion windows (cwnd * mss from TCP_INFO), since data beyond that
+ * only waits in the buffer for the next round trips. A Unix socket has no
+ * window, so there the free space alone decides. With AWS_NOTSENT_LOWAT
+ * set, the socket holds little more than that many unsent bytes, so the
+ * block is not made larger either. The result is kept between
+ * AWS_TX_CHUNK_MIN and AWS_TX_CHUNK_MAX and measured again every
+ * AWS_TX_CHUNK_PROBE blocks.
+ *
+ * SO_SNDBUF itself is left to the kernel: setting it would turn off the
+ * autotuning that already grows the buffer with the connection's window.
+ *
+ * 2022, Operating Systems
+ */
+
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include "aws.h"
+#include "tx_chunk.h"
+#include "stats.h"
+
+#define MIN(a,b) (((a)<(b))?(a):(b))
+#define MAX(a,b) (((a)>(b))?(a):(b))
+
+/* Bytes the socket could take now and, for TCP, in two round trips. */
+
+static size_t tx_chunk_measure(int sockfd)
+{
+	struct tcp_info info;
+	socklen_t len;
+	int sndbuf, queued;
+	size_t space;
+
+	len = sizeof(sndbuf);
+	if (getsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len) < 0 ||
+			ioctl(sockfd, SIOCOUTQ, &queued) < 0)
+		return AWS_TX_CHUNK_MIN;
+
+	space = sndbuf > queued ? sndbuf - queued : 0;
+	if (AWS_NOTSENT_LOWAT > 0)
+		space = MIN(space, AWS_NOTSENT_LOWAT);
+
+	len = sizeof(info);
+	if (getsockopt(sockfd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0 &&
+			info.tcpi_snd_cwnd > 0 && info.tcpi_snd_mss > 0)
+		space = MIN(space, 2 * (size_t)info.tcpi_snd_cwnd *
+				info.tcpi_snd_mss);
+
+	return space;
+}
+
+/*
+ * Size of the next block to read for the connection on sockfd, a multiple
+ * of AWS_TX_CHUNK_MIN.
+ */
+
+size_t tx_chunk_next(int sockfd, struct tx_chunk *c)
+{
+	size_t size;
+
+	if (c->size != 0 && ++c->age < AWS_TX_CHUNK_PROBE)
+		return c->size;
+
+	size = tx_chunk_measure(sockfd);
+	size = MAX(MIN(size, AWS_TX_CHUNK_MAX), AWS_TX_CHUNK_MIN);
+	size -= size % AWS_TX_CHUNK_MIN;
+
+	aws_stats.tx_chunk_probes++;
+	if (c->size != 0 && size > c->size)
+		aws_stats.tx_chunk_grows++;
+	else if (size < c->size)
+		aws_stats.tx_chunk_shrinks++;
+
+	c->size = size;
+	c->age = 0;
+
+	return size;
+}
@@ -0,0 +1,34 @@
+/*
+ * Transmit chunks - block sizes that follow how fast a peer drains
+ *
+ * 2022, Operating Systems
+ */
+
+#ifndef TX_CHUNK_H_
+#define TX_CHUNK_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/* the size of the next blocks read for one connection */
+struct tx_chunk {
+	size_t size;
+	unsigned int age;	/* blocks since size was last measured */
+};
+
+static inline void tx_chunk_init(struct tx_chunk *c)
+{
+	c->size = 0;
+	c->age = 0;
+}
+
+size_t tx_chunk_next(int sockfd, struct tx_chunk *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TX_CHUNK_H_ */
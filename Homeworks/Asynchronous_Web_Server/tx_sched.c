@@ -0,0 +1,131 @@
+/*
+ * Transmission scheduler - deficit round-robin over writable connections
+ *
+ * Every writable connection gets AWS_TX_QUANTUM more bytes of credit per
+ * round and may send up to its credit, so a large transfer can no longer
+ * hold the reactor until it completes. With AWS_TX_SMALL_FIRST, responses
+ * with at most AWS_TX_SMALL_SZ bytes left are kept on a separate list that
+ * is served first in each round (shortest remaining first, in coarse form),
+ * which bounds the wait of small objects behind bulk downloads.
+ *
+ * 2022, Operating Systems
+ */
+
+#include "aws.h"
+#include "tx_sched.h"
+
+struct tx_list {
+	struct tx_entry *head;
+	struct tx_entry *tail;
+	size_t len;
+};
+
+static struct tx_list small_list;
+static struct tx_list bulk_list;
+
+static void list_append(struct tx_list *l, struct tx_entry *e)
+{
+	e->list = l;
+	e->next = NULL;
+	e->prev = l->tail;
+	if (l->tail)
+		l->tail->next = e;
+	else
+		l->head = e;
+	l->tail = e;
+	l->len++;
+}
+
+static void list_unlink(struct tx_list *l, struct tx_entry *e)
+{
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		l->head = e->next;
+	if (e->next)
+		e->next->prev = e->prev;
+	else
+		l->tail = e->prev;
+	e->prev = e->next = NULL;
+	e->list = NULL;
+	l->len--;
+}
+
+static struct tx_list *list_for(struct tx_entry *e)
+{
+	if (AWS_TX_SMALL_FIRST && e->remaining <= AWS_TX_SMALL_SZ)
+		return &small_list;
+
+	return &bulk_list;
+}
+
+void tx_entry_init(struct tx_entry *e)
+{
+	e->prev = e->next = NULL;
+	e->deficit = 0;
+	e->remaining = 0;
+	e->list = NULL;
+}
+
+/* Mark e as writable; adding an entry that is already queued is a no-op. */
+
+void tx_sched_add(struct tx_entry *e)
+{
+	if (e->list != NULL)
+		return;
+
+	list_append(list_for(e), e);
+}
+
+void tx_sched_remove(struct tx_entry *e)
+{
+	if (e->list != NULL)
+		list_unlink(e->list, e);
+}
+
+int tx_sched_pending(void)
+{
+	return small_list.len + bulk_list.len > 0;
+}
+
+/* give each of the first n entries of l one turn */
+static void list_round(struct tx_list *l, size_t n, tx_send_fn send)
+{
+	struct tx_entry *e;
+	enum tx_status status;
+	size_t sent;
+
+	while (n-- > 0 && l->head != NULL) {
+		e = l->head;
+		list_unlink(l, e);
+		e->deficit += AWS_TX_QUANTUM;
+
+		sent = 0;
+		status = send(e, e->deficit, &sent);
+		if (status == TX_DONE)
+			continue;	/* e may be gone */
+
+		e->deficit = sent < e->deficit ? e->deficit - sent : 0;
+		if (status == TX_BLOCKED) {
+			/* an idle flow does not keep its credit */
+			e->deficit = 0;
+			continue;
+		}
+
+		list_append(list_for(e), e);
+	}
+}
+
+/*
+ * Run one round over the connections that were writable when it started;
+ * entries re-queued during the round wait for the next one.
+ */
+
+void tx_sched_round(tx_send_fn send)
+{
+	size_t small = small_list.len;
+	size_t bulk = bulk_list.len;
+
+	list_round(&small_list, small, send);
+	list_round(&bulk_list, bulk, send);
+}
@@ -0,0 +1,49 @@
+/*
+ * Transmission scheduler - deficit round-robin over writable connections
+ *
+ * 2022, Operating Systems
+ */
+
+#ifndef TX_SCHED_H_
+#define TX_SCHED_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/* embedded in every connection that has a response to send */
+struct tx_entry {
+	struct tx_entry *prev;
+	struct tx_entry *next;
+	size_t deficit;		/* bytes the entry may still send this turn */
+	size_t remaining;	/* bytes left in the response, kept by the owner */
+	void *list;		/* list the entry is queued on, NULL if none */
+};
+
+enum tx_status {
+	TX_MORE,		/* budget used up, more to send */
+	TX_BLOCKED,		/* socket full, wait for EPOLLOUT */
+	TX_DONE			/* response complete or connection gone */
+};
+
+/*
+ * Send at most budget bytes for e and report how many went out in sent.
+ * After TX_DONE the scheduler does not touch e again, so the callee may
+ * free it.
+ */
+typedef enum tx_status (*tx_send_fn)(struct tx_entry *e, size_t budget,
+		size_t *sent);
+
+void tx_entry_init(struct tx_entry *e);
+void tx_sched_add(struct tx_entry *e);
+void tx_sched_remove(struct tx_entry *e);
+int tx_sched_pending(void);
+void tx_sched_round(tx_send_fn send);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TX_SCHED_H_ */
@@ -14,6 +14,21 @@ extern "C" {
 
 #define EPOLL_TIMEOUT_INFINITE		-1
 
+#include <stdint.h>
+#include <sys/ioctl.h>
+
+/* epoll busy poll parameters (Linux 6.9), for older headers */
+#ifndef EPIOCSPARAMS
+struct epoll_params {
+	uint32_t busy_poll_usecs;
+	uint16_t busy_poll_budget;
+	uint8_t prefer_busy_poll;
+	uint8_t __pad;
+};
+
+#define EPOLL_IOC_TYPE			0x8A
+#define EPIOCSPARAMS			_IOW(EPOLL_IOC_TYPE, 0x01, struct epoll_params)
+#endif
 
 static inline int w_epoll_create(void)
 {
@@ -30,6 +45,17 @@ static inline int w_epoll_add_fd_in(int epollfd, int fd)
 	return epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev);
 }
 
+/* one of the processes sharing fd is woken, not all of them */
+static inline int w_epoll_add_fd_in_exclusive(int epollfd, int fd)
+{
+	struct epoll_event ev;
+
+	ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+	ev.data.fd = fd;
+
+	return epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
 static inline int w_epoll_add_fd_out(int epollfd, int fd)
 {
 	struct epoll_event ev;
@@ -155,6 +181,16 @@ static inline int w_epoll_update_ptr_inout(int epollfd, int fd, void *ptr)
 	return epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &ev);
 }
 
+static inline int w_epoll_update_ptr_rdhup(int epollfd, int fd, void *ptr)
+{
+	struct epoll_event ev;
+
+	ev.events = EPOLLRDHUP;
+	ev.data.ptr = ptr;
+
+	return epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
 static inline int w_epoll_remove_ptr(int epollfd, int fd, void *ptr)
 {
 	struct epoll_event ev;
@@ -174,6 +210,28 @@ static inline int w_epoll_wait_infinite(int epollfd, struct epoll_event *rev)
 {
 	return epoll_wait(epollfd, rev, 1, EPOLL_TIMEOUT_INFINITE);
 }
+
+static inline int w_epoll_wait_timeout(int epollfd, struct epoll_event *rev,
+		int maxevents, int timeout)
+{
+	return epoll_wait(epollfd, rev, maxevents, timeout);
+}
+
+/*
+ * Have a blocking wait poll the device queues of the sockets in the set for
+ * up to usecs (and budget packets per poll) before sleeping.
+ */
+static inline int w_epoll_busy_poll(int epollfd, unsigned int usecs,
+		unsigned int budget)
+{
+	struct epoll_params params = {
+		.busy_poll_usecs = usecs,
+		.busy_poll_budget = budget,
+		.prefer_busy_poll = 1,
+	};
+
+	return ioctl(epollfd, EPIOCSPARAMS, &params);
+}
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,140 @@
+/*
+ * Workers - one event loop process per CPU
+ *
+ * With AWS_WORKERS above one, the server forks that many workers, each
+ * running the whole event loop and pinned to a CPU of its own. Worker i
+ * accepts on the i-th of a group of SO_REUSEPORT listeners, and a classic
+ * BPF program on the group (see tcp_steer_by_cpu()) hands each new
+ * connection to the listener of the CPU that received its packets. A
+ * connection is therefore handled on the core whose caches already hold
+ * its socket.
+ *
+ * Workers are pinned before they set anything up, so everything they
+ * allocate is first touched on their CPU and, with the default local
+ * allocation policy, comes from its NUMA node. Their pool threads inherit
+ * the pin.
+ *
+ * The parent only holds the listeners and restarts workers that die; as
+ * the listeners stay open in it, a restart loses no queued connection.
+ *
+ * 2022, Operating Systems
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "util.h"
+#include "debug.h"
+#include "aws.h"
+#include "workers.h"
+
+/*
+ * Store the CPUs this process may run on, lowest first, at most max of
+ * them. Returns their number.
+ */
+
+int workers_cpus(int *cpus, int max)
+{
+	cpu_set_t set;
+	int cpu, n = 0;
+
+	if (sched_getaffinity(0, sizeof(set), &set) < 0) {
+		cpus[0] = 0;
+		return 1;
+	}
+
+	for (cpu = 0; cpu < CPU_SETSIZE && n < max; cpu++)
+		if (CPU_ISSET(cpu, &set))
+			cpus[n++] = cpu;
+
+	return n;
+}
+
+static void worker_pin(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) < 0)
+		ERR("sched_setaffinity");
+}
+
+/* Fork worker index. Returns the child's pid in the parent, 0 in it. */
+
+static pid_t worker_fork(int index, int cpu)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid != 0)
+		return pid;
+
+	/* the workers go when the parent does */
+	prctl(PR_SET_PDEATHSIG, SIGTERM);
+	if (getppid() == 1)
+		_exit(EXIT_FAILURE);
+
+	worker_pin(cpu);
+	dlog(LOG_INFO, "Worker %d on CPU %d\n", index, cpu);
+
+	return 0;
+}
+
+/*
+ * Fork n workers, worker i pinned to cpus[i]. Returns i in worker i. The
+ * parent does not return: it restarts the workers that exit, waiting a
+ * second first if one dies right after it was started. -1 is returned
+ * only if the first fork fails.
+ */
+
+int workers_spawn(int n, const int *cpus)
+{
+	pid_t pids[AWS_WORKERS_MAX];
+	time_t started[AWS_WORKERS_MAX];
+	pid_t pid;
+	int i, status;
+
+	for (i = 0; i < n; i++) {
+		pids[i] = worker_fork(i, cpus[i]);
+		if (pids[i] == 0)
+			return i;
+		if (pids[i] < 0 && i == 0)
+			return -1;
+		started[i] = time(NULL);
+	}
+
+	while (1) {
+		pid = wait(&status);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			/* no children left: some forks failed, try again */
+			sleep(1);
+			pid = 0;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (pids[i] != pid && pids[i] >= 0)
+				continue;
+
+			if (pid > 0)
+				dlog(LOG_ERR, "Worker %d exited (status %d)\n",
+					i, status);
+			if (time(NULL) - started[i] < 1)
+				sleep(1);
+
+			pids[i] = worker_fork(i, cpus[i]);
+			if (pids[i] == 0)
+				return i;
+			started[i] = time(NULL);
+		}
+	}
+}
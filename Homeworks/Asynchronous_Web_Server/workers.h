@@ -0,0 +1,21 @@
+/*
+ * Workers - one event loop process per CPU
+ *
+ * 2022, Operating Systems
+ */
+
+#ifndef WORKERS_H_
+#define WORKERS_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int workers_cpus(int *cpus, int max);
+int workers_spawn(int n, const int *cpus);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WORKERS_H_ */
@@ -0,0 +1,122 @@
+/*
+ * Zero-copy sends - MSG_ZEROCOPY with completions from the error queue
+ *
+ * A send with MSG_ZEROCOPY pins the user pages instead of copying them
+ * into the socket buffer, so they must stay untouched until the kernel
+ * is done with them. It says so on the socket's error queue: each
+ * successful zero-copy send gets the next 32-bit id, and a notification
+ * covers a range of ids. A pending notification shows up as EPOLLERR,
+ * which the event loop answers with zc_reap().
+ *
+ * Pinning and the notification cost more than copying a small buffer,
+ * so only sends of at least AWS_ZEROCOPY_MIN bytes use it. Where the
+ * kernel ends up copying anyway (loopback, devices without scatter-gather)
+ * the notification says so; zerocopy_copied in the stats counts those.
+ *
+ * 2022, Operating Systems
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <sys/socket.h>
+
+#include "aws.h"
+#include "zerocopy.h"
+#include "stats.h"
+
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY		5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED	1
+#endif
+
+static size_t msg_len(const struct msghdr *msg)
+{
+	size_t len = 0;
+	size_t i;
+
+	for (i = 0; i < msg->msg_iovlen; i++)
+		len += msg->msg_iov[i].iov_len;
+
+	return len;
+}
+
+/*
+ * sendmsg() msg on sockfd, without copying if it is big enough and the
+ * socket allows it. Returns what sendmsg() returns.
+ */
+
+ssize_t zc_sendmsg(int sockfd, struct zc_state *z, const struct msghdr *msg,
+		int flags)
+{
+	size_t len = msg_len(msg);
+	ssize_t rc;
+	int one = 1;
+
+	if (!AWS_ZEROCOPY || len < AWS_ZEROCOPY_MIN || z->enabled < 0)
+		return sendmsg(sockfd, msg, flags);
+
+	if (z->enabled == 0) {
+		z->enabled = setsockopt(sockfd, SOL_SOCKET, SO_ZEROCOPY,
+				&one, sizeof(one)) == 0 ? 1 : -1;
+		if (z->enabled < 0) {
+			aws_stats.zerocopy_fallbacks++;
+			return sendmsg(sockfd, msg, flags);
+		}
+	}
+
+	rc = sendmsg(sockfd, msg, flags | MSG_ZEROCOPY);
+	if (rc < 0 && errno == ENOBUFS) {
+		/* over the socket's pinned memory limit: copy this one */
+		aws_stats.zerocopy_fallbacks++;
+		return sendmsg(sockfd, msg, flags);
+	}
+	if (rc > 0) {
+		z->next++;
+		aws_stats.zerocopy_sends++;
+		aws_stats.zerocopy_bytes += rc;
+	}
+
+	return rc;
+}
+
+/* Read the completions waiting on the error queue of sockfd. */
+
+void zc_reap(int sockfd, struct zc_state *z)
+{
+	char control[CMSG_SPACE(sizeof(struct sock_extended_err))];
+	struct sock_extended_err *ee;
+	struct cmsghdr *cm;
+	struct msghdr msg;
+
+	while (zc_pending(z) > 0) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg(sockfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+			return;
+
+		for (cm = CMSG_FIRSTHDR(&msg); cm != NULL;
+				cm = CMSG_NXTHDR(&msg, cm)) {
+			if (!((cm->cmsg_level == SOL_IP &&
+					cm->cmsg_type == IP_RECVERR) ||
+					(cm->cmsg_level == SOL_IPV6 &&
+					cm->cmsg_type == IPV6_RECVERR)))
+				continue;
+
+			ee = (struct sock_extended_err *)CMSG_DATA(cm);
+			if (ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+
+			/* ids ee_info to ee_data, in order */
+			z->done = ee->ee_data + 1;
+			if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				aws_stats.zerocopy_copied +=
+					ee->ee_data - ee->ee_info + 1;
+		}
+	}
+}
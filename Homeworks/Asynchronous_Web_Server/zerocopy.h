@@ -0,0 +1,46 @@
+/*
+ * Zero-copy sends - MSG_ZEROCOPY with completions from the error queue
+ *
+ * 2022, Operating Systems
+ */
+
+#ifndef ZEROCOPY_H_
+#define ZEROCOPY_H_	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/* MSG_ZEROCOPY sends on one socket */
+struct zc_state {
+	uint32_t next;		/* id the kernel gives the next send */
+	uint32_t done;		/* sends whose pages the kernel let go of */
+	int enabled;		/* SO_ZEROCOPY: 1 set, -1 refused, 0 not tried */
+};
+
+static inline void zc_init(struct zc_state *z)
+{
+	z->next = 0;
+	z->done = 0;
+	z->enabled = 0;
+}
+
+/* Sends whose buffers the kernel may still read. */
+static inline uint32_t zc_pending(const struct zc_state *z)
+{
+	return z->next - z->done;
+}
+
+ssize_t zc_sendmsg(int sockfd, struct zc_state *z, const struct msghdr *msg,
+		int flags);
+void zc_reap(int sockfd, struct zc_state *z);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ZEROCOPY_H_ */